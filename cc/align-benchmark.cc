@@ -0,0 +1,76 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+#include "fasta-read.hh"
+#include "amino-acids.hh"
+
+// ----------------------------------------------------------------------
+
+// Number of allocations and time of translate_and_align() for the
+// nucleotide sequences of a fasta file (e.g. gisaid download, xz and bz2
+// are decompressed). Global operator new is replaced in this program,
+// only allocations made inside translate_and_align() are counted.
+//   dist/align-benchmark <fasta>
+
+static bool sCountAllocations = false;
+static size_t sAllocations = 0, sAllocatedBytes = 0;
+
+void* operator new(size_t aSize)
+{
+    if (sCountAllocations) {
+        ++sAllocations;
+        sAllocatedBytes += aSize;
+    }
+    if (void* allocated = std::malloc(aSize ? aSize : 1))
+        return allocated;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* aPtr) noexcept { std::free(aPtr); }
+void operator delete(void* aPtr, size_t) noexcept { std::free(aPtr); }
+
+// ----------------------------------------------------------------------
+
+int main(int argc, const char *argv[])
+{
+    int exit_code = 0;
+    try {
+        if (argc != 2)
+            throw std::runtime_error(std::string("Usage: ") + argv[0] + " <fasta>");
+        const auto records = read_fasta_with_name_parsing(argv[1], std::string(), std::string());
+        size_t sequences = 0, aligned = 0;
+        std::chrono::steady_clock::duration elapsed{0};
+        for (const auto& record: records) {
+            const auto sequence = record.find("sequence");
+            if (sequence == record.end() || !is_nucleotides(sequence->second))
+                continue;
+            Messages messages;
+            sCountAllocations = true;
+            const auto start = std::chrono::steady_clock::now();
+            const auto result = translate_and_align(sequence->second, messages);
+            elapsed += std::chrono::steady_clock::now() - start;
+            sCountAllocations = false;
+            ++sequences;
+            if (result.shift.aligned())
+                ++aligned;
+        }
+        const double per_sequence = sequences ? 1.0 / static_cast<double>(sequences) : 0.0;
+        std::cout << "sequences:   " << sequences << " (aligned " << aligned << ")" << std::endl
+                  << "allocations: " << sAllocations << " (" << std::fixed << std::setprecision(1) << static_cast<double>(sAllocations) * per_sequence << " per sequence)" << std::endl
+                  << "allocated:   " << static_cast<double>(sAllocatedBytes) / 1024.0 / 1024.0 << " MB (" << static_cast<double>(sAllocatedBytes) * per_sequence / 1024.0 << " KB per sequence)" << std::endl
+                  << "time:        " << std::chrono::duration<double, std::milli>(elapsed).count() << " ms (" << std::chrono::duration<double, std::micro>(elapsed).count() * per_sequence << " us per sequence)" << std::endl;
+    }
+    catch (std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        exit_code = 1;
+    }
+    return exit_code;
+}
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
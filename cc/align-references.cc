@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <numeric>
+
+#include "align-references.hh"
+
+// ----------------------------------------------------------------------
+
+namespace
+{
+    constexpr long Band = 12;                 // max number of insertions/deletions relative to the dominant diagonal
+    constexpr unsigned MinimumDiagonalVotes = 10;
+    constexpr size_t LeadingHits = 20;        // number of first kmer hits near the dominant diagonal used to find shift at the beginning of the sequence
+    constexpr int Match = 2;
+    constexpr int Mismatch = -1;
+    constexpr int Gap = 3;
+    constexpr int MinimumScore = static_cast<int>(MINIMUM_SEQUENCE_AA_LENGTH);
+}
+
+constexpr ReferenceAligner::Kmer ReferenceAligner::InvalidKmer;
+
+// ----------------------------------------------------------------------
+
+void ReferenceAligner::add_reference(std::string aSubtype, std::string aLineage, std::string aGene, std::string aAminoAcids, Shift aShift)
+{
+    mReferences.emplace_back(aSubtype, aLineage, aGene, aAminoAcids, aShift);
+    auto& ref = mReferences.back();
+
+      // index of kmer positions (counting sort by kmer)
+    std::vector<Kmer> ref_kmers;
+    kmers(ref.amino_acids.cbegin(), ref.amino_acids.cend(), ref_kmers);
+    ref.kmer_first.assign(NumberOfKmers + 1, 0);
+    for (auto kmer: ref_kmers) {
+        if (kmer != InvalidKmer)
+            ++ref.kmer_first[kmer + 1];
+    }
+    std::partial_sum(ref.kmer_first.begin(), ref.kmer_first.end(), ref.kmer_first.begin());
+    ref.kmer_position.resize(ref.kmer_first.back());
+    std::vector<uint32_t> next(ref.kmer_first.begin(), ref.kmer_first.end() - 1);
+    for (size_t pos = 0; pos < ref_kmers.size(); ++pos) {
+        if (ref_kmers[pos] != InvalidKmer)
+            ref.kmer_position[next[ref_kmers[pos]]++] = static_cast<uint32_t>(pos);
+    }
+
+} // ReferenceAligner::add_reference
+
+// ----------------------------------------------------------------------
+
+AlignData ReferenceAligner::align(std::string::const_iterator aBegin, std::string::const_iterator aEnd, Messages& aMessages) const
+{
+    const size_t size = static_cast<size_t>(aEnd - aBegin);
+    std::vector<Kmer> query_kmers;
+    kmers(aBegin, aEnd, query_kmers);
+
+    const Reference* best = nullptr;
+    int best_score = MinimumScore - 1;
+    long best_diagonal = 0;
+    const Reference* second = nullptr;
+    int second_score = 0;
+    std::vector<unsigned> votes;
+    for (const auto& ref: mReferences) {
+          // diagonal (reference_pos - query_pos) is stored at index diagonal + size
+        votes.assign(size + ref.amino_acids.size(), 0);
+        for (size_t query_pos = 0; query_pos < query_kmers.size(); ++query_pos) {
+            const auto kmer = query_kmers[query_pos];
+            if (kmer != InvalidKmer) {
+                for (auto pos = ref.kmer_first[kmer]; pos < ref.kmer_first[kmer + 1]; ++pos)
+                    ++votes[ref.kmer_position[pos] + size - query_pos];
+            }
+        }
+        const auto max_votes = std::max_element(votes.begin(), votes.end());
+        if (max_votes != votes.end() && *max_votes >= MinimumDiagonalVotes) {
+            const long diagonal = (max_votes - votes.begin()) - static_cast<long>(size);
+            const int score = banded_local_score(aBegin, aEnd, ref.amino_acids, diagonal);
+            if (score > best_score) {
+                if (best != nullptr) {
+                    second = best;
+                    second_score = best_score;
+                }
+                best = &ref;
+                best_score = score;
+                best_diagonal = diagonal;
+            }
+            else if (score > second_score) {
+                second = &ref;
+                second_score = score;
+            }
+        }
+    }
+
+    if (best == nullptr)
+        return AlignData();
+    if (second != nullptr && second->subtype != best->subtype && second_score * 10 > best_score * 9)
+        aMessages.warning() << "Reference alignment is ambiguous: " << best->subtype << ' ' << best->gene << ':' << best_score << " vs. " << second->subtype << ' ' << second->gene << ':' << second_score << std::endl;
+    const auto diagonal = leading_diagonal(query_kmers, *best, best_diagonal);
+    return AlignData(best->subtype, best->lineage, best->gene, static_cast<Shift::ShiftT>(best->shift) + static_cast<Shift::ShiftT>(diagonal));
+
+} // ReferenceAligner::align
+
+// ----------------------------------------------------------------------
+
+// Dominant diagonal may differ from the diagonal at the beginning of the
+// sequence if there are insertions/deletions. Shift is defined by the
+// beginning, so look at the first kmer hits within the band.
+long ReferenceAligner::leading_diagonal(const std::vector<Kmer>& aQueryKmers, const Reference& aReference, long aDiagonal)
+{
+    unsigned votes[2 * Band + 1] = {};
+    size_t hits = 0;
+    for (size_t query_pos = 0; query_pos < aQueryKmers.size() && hits < LeadingHits; ++query_pos) {
+        const auto kmer = aQueryKmers[query_pos];
+        if (kmer != InvalidKmer) {
+            for (auto pos = aReference.kmer_first[kmer]; pos < aReference.kmer_first[kmer + 1]; ++pos) {
+                const long band_offset = static_cast<long>(aReference.kmer_position[pos]) - static_cast<long>(query_pos) - aDiagonal + Band;
+                if (band_offset >= 0 && band_offset <= 2 * Band) {
+                    ++votes[band_offset];
+                    ++hits;
+                }
+            }
+        }
+    }
+    return aDiagonal + (std::max_element(std::begin(votes), std::end(votes)) - std::begin(votes)) - Band;
+
+} // ReferenceAligner::leading_diagonal
+
+// ----------------------------------------------------------------------
+
+void ReferenceAligner::kmers(std::string::const_iterator aBegin, std::string::const_iterator aEnd, std::vector<Kmer>& aKmers)
+{
+    const size_t size = static_cast<size_t>(aEnd - aBegin);
+    aKmers.assign(size < KmerSize ? 0 : size - KmerSize + 1, InvalidKmer);
+    Kmer kmer = 0;
+    size_t valid = 0;           // number of consecutive valid aa ending at the current position
+    for (size_t pos = 0; pos < size; ++pos) {
+        const char aa = aBegin[static_cast<std::string::difference_type>(pos)];
+        if (aa >= 'A' && aa <= 'Z' && aa != 'X') {
+            kmer = ((kmer << 5) | static_cast<Kmer>(aa - 'A')) & static_cast<Kmer>(NumberOfKmers - 1);
+            ++valid;
+        }
+        else {
+            valid = 0;
+        }
+        if (valid >= KmerSize)
+            aKmers[pos + 1 - KmerSize] = kmer;
+    }
+
+} // ReferenceAligner::kmers
+
+// ----------------------------------------------------------------------
+
+// Smith-Waterman with linear gap penalty restricted to reference
+// positions [query_pos + aDiagonal - Band, query_pos + aDiagonal + Band].
+// Rows are stored by band offset, so the previous row value at the same
+// offset is the diagonal predecessor and at offset + 1 is the one above.
+int ReferenceAligner::banded_local_score(std::string::const_iterator aBegin, std::string::const_iterator aEnd, const std::string& aReference, long aDiagonal)
+{
+    constexpr size_t width = 2 * Band + 1;
+    int rows[2][width + 2] = {}; // +2: zero sentinels on both sides of the band
+    int* previous = rows[0];
+    int* current = rows[1];
+    int best = 0;
+    const long ref_size = static_cast<long>(aReference.size());
+    const long query_size = aEnd - aBegin;
+    for (long query_pos = 0; query_pos < query_size; ++query_pos) {
+        const char query_aa = aBegin[query_pos];
+        for (size_t offset = 1; offset <= width; ++offset) {
+            const long ref_pos = query_pos + aDiagonal + static_cast<long>(offset) - 1 - Band;
+            if (ref_pos < 0 || ref_pos >= ref_size) {
+                current[offset] = 0;
+            }
+            else {
+                const char ref_aa = aReference[static_cast<size_t>(ref_pos)];
+                const int substitution = (query_aa == 'X' || ref_aa == 'X') ? 0 : (query_aa == ref_aa ? Match : Mismatch);
+                const int value = std::max(std::max(0, previous[offset] + substitution), std::max(previous[offset + 1], current[offset - 1]) - Gap);
+                current[offset] = value;
+                best = std::max(best, value);
+            }
+        }
+        std::swap(previous, current);
+    }
+    return best;
+
+} // ReferenceAligner::banded_local_score
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
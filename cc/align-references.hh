@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "messages.hh"
+#include "sequence-shift.hh"
+#include "amino-acids.hh"
+
+// ----------------------------------------------------------------------
+
+// Fallback aligner for sequences not matched by any of the
+// ALIGN_RAW_DATA motifs. Sequence is compared with the reference
+// sequences (usually the longest aligned sequences of each
+// subtype/lineage/gene found in seqdb). For each reference the
+// dominant diagonal is found by 3-mer voting, then the sequence is
+// scored by the local alignment restricted to a narrow band around
+// that diagonal. Subtype, lineage, gene and shift come from the best
+// scoring reference, shift is taken from the diagonal at the beginning
+// of the sequence.
+
+class ReferenceAligner
+{
+ public:
+    inline ReferenceAligner() {}
+
+      // aShift is the shift of aAminoAcids in the reference (i.e. what SeqdbSeq::amino_acids_shift() returns)
+    void add_reference(std::string aSubtype, std::string aLineage, std::string aGene, std::string aAminoAcids, Shift aShift);
+    inline size_t number_of_references() const { return mReferences.size(); }
+
+    AlignData align(std::string::const_iterator aBegin, std::string::const_iterator aEnd, Messages& aMessages) const;
+    inline AlignData align(const std::string& aAminoAcids, Messages& aMessages) const { return align(aAminoAcids.cbegin(), aAminoAcids.cend(), aMessages); }
+
+ private:
+    typedef uint32_t Kmer;
+
+    struct Reference : public AlignData
+    {
+        inline Reference(std::string aSubtype, std::string aLineage, std::string aGene, std::string aAminoAcids, Shift aShift)
+            : AlignData(aSubtype, aLineage, aGene, aShift), amino_acids(aAminoAcids) {}
+
+        std::string amino_acids;
+        std::vector<uint32_t> kmer_first; // kmer_position[kmer_first[kmer] .. kmer_first[kmer + 1]] - positions of kmer in amino_acids
+        std::vector<uint32_t> kmer_position;
+    };
+
+    std::vector<Reference> mReferences;
+
+    static constexpr size_t KmerSize = 3;
+    static constexpr Kmer InvalidKmer = ~Kmer(0);
+    static constexpr size_t NumberOfKmers = size_t(1) << (5 * KmerSize);
+
+    static void kmers(std::string::const_iterator aBegin, std::string::const_iterator aEnd, std::vector<Kmer>& aKmers);
+    static long leading_diagonal(const std::vector<Kmer>& aQueryKmers, const Reference& aReference, long aDiagonal);
+    static int banded_local_score(std::string::const_iterator aBegin, std::string::const_iterator aEnd, const std::string& aReference, long aDiagonal);
+
+}; // class ReferenceAligner
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
@@ -0,0 +1,58 @@
+#include "amino-acid-profile.hh"
+
+// ----------------------------------------------------------------------
+
+constexpr const char AminoAcidProfile::Residues[];
+constexpr size_t AminoAcidProfile::NumberOfResidues;
+
+// ----------------------------------------------------------------------
+
+AminoAcidProfile::AminoAcidProfile()
+    : mNumberOfSequences(0)
+{
+    const auto unknown = static_cast<uint8_t>(std::string(Residues).find('X'));
+    mResidueIndex.fill(unknown);
+    for (size_t index = 0; index < NumberOfResidues; ++index)
+        mResidueIndex[static_cast<unsigned char>(Residues[index])] = static_cast<uint8_t>(index);
+
+} // AminoAcidProfile::AminoAcidProfile
+
+// ----------------------------------------------------------------------
+
+void AminoAcidProfile::add(const std::string& aAligned)
+{
+    if (number_of_positions() < aAligned.size())
+        mCounts.resize(aAligned.size() * NumberOfResidues, 0);
+    Count* row = mCounts.data();
+    for (auto aa: aAligned) {
+        ++row[mResidueIndex[static_cast<unsigned char>(aa)]];
+        row += NumberOfResidues;
+    }
+    ++mNumberOfSequences;
+
+} // AminoAcidProfile::add
+
+// ----------------------------------------------------------------------
+
+std::string AminoAcidProfile::consensus() const
+{
+    const auto unknown = mResidueIndex[static_cast<unsigned char>('X')];
+    std::string result(number_of_positions(), 'X');
+    for (size_t pos = 0; pos < result.size(); ++pos) {
+        const Count* row = mCounts.data() + pos * NumberOfResidues;
+        Count max_count = 0;
+        for (size_t index = 0; index < NumberOfResidues; ++index) {
+            if (index != unknown && row[index] > max_count) {
+                max_count = row[index];
+                result[pos] = Residues[index];
+            }
+        }
+    }
+    return result;
+
+} // AminoAcidProfile::consensus
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <array>
+#include <cstdint>
+
+#include "seqdb.hh"
+
+// ----------------------------------------------------------------------
+
+// Number of occurences of each residue at each position of the aligned
+// amino acid sequences. Counts are stored densely: row per position,
+// column per residue in the order of Residues, so the matrix can be
+// exposed as is (e.g. to numpy).
+
+class AminoAcidProfile
+{
+ public:
+    typedef uint32_t Count;
+    static constexpr const char Residues[] = "ACDEFGHIKLMNPQRSTVWYBZX*-"; // unknown residues are counted as X
+    static constexpr size_t NumberOfResidues = sizeof(Residues) - 1;
+
+    AminoAcidProfile();
+
+    void add(const std::string& aAligned);
+
+      // adds aligned amino acids of the sequences selected by the iterator, not aligned sequences are ignored
+    template <typename Iterator> inline void add(Iterator aFirst, Iterator aLast)
+        {
+            for (; aFirst != aLast; ++aFirst) {
+                const auto entry_seq = *aFirst;
+                if (entry_seq.seq().aligned())
+                    add(entry_seq.seq().amino_acids_aligned());
+            }
+        }
+
+    inline size_t number_of_positions() const { return mCounts.size() / NumberOfResidues; }
+    inline size_t number_of_sequences() const { return mNumberOfSequences; }
+    inline Count count(size_t aPos, char aResidue) const { return aPos < number_of_positions() ? mCounts[aPos * NumberOfResidues + mResidueIndex[static_cast<unsigned char>(aResidue)]] : 0; }
+    inline const Count* data() const { return mCounts.data(); }
+    inline std::string residues() const { return Residues; }
+
+      // the most frequent residue (X excluded) at each position
+    std::string consensus() const;
+
+ private:
+    std::vector<Count> mCounts;
+    size_t mNumberOfSequences;
+    std::array<uint8_t, 256> mResidueIndex;
+
+}; // class AminoAcidProfile
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
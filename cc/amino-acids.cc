@@ -2,6 +2,9 @@
 #include <map>
 #include <regex>
 #include <numeric>
+#include <chrono>
+#include <atomic>
+#include <array>
 
 #include "string.hh"
 #include "stream.hh"
@@ -9,48 +12,67 @@
 
 // ----------------------------------------------------------------------
 
+typedef std::chrono::steady_clock AlignClock;
+
+static bool align_statistics_enabled();
+static void align_statistics_translate(int aOffset, size_t aNumberOfResults, AlignClock::duration aLatency); // aOffset < 0: not aligned
+
+// ----------------------------------------------------------------------
+
 // Some sequences from CNIC (and perhaps from other labs) have initial
 // part of nucleotides with stop codons inside. To figure out correct
 // translation we have first to translate with all possible offsets
 // (0, 1, 2) and not stoppoing at stop codons, then try to align all
 // of them. Most probably just one offset leads to finding correct
 // align shift.
-AlignAminoAcidsData translate_and_align(std::string aNucleotides, Messages& aMessages)
+AlignAminoAcidsData translate_and_align(const std::string& aNucleotides, Messages& aMessages, const Aligner& aAligner)
 {
-    std::vector<AlignAminoAcidsData> r;
+    const bool statistics = align_statistics_enabled();
+    const auto start = statistics ? AlignClock::now() : AlignClock::time_point();
+    AlignAminoAcidsData result;
+    size_t number_of_results = 0;
     AlignAminoAcidsData not_aligned;
+    std::string amino_acids; // translation buffer reused for all offsets, parts between stop codons are aligned in place
     for (int offset = 0; offset < 3; ++offset) {
-        auto amino_acids = translate_nucleotides_to_amino_acids(aNucleotides, static_cast<size_t>(offset), aMessages);
-        auto aa_parts = string::split(amino_acids, "*");
-        size_t prefix_len = 0;
-        for (const auto& part: aa_parts) {
-            if (part.size() >= MINIMUM_SEQUENCE_AA_LENGTH) {
+        translate_nucleotides_to_amino_acids(aNucleotides, static_cast<size_t>(offset), amino_acids);
+        for (size_t part_start = 0; part_start <= amino_acids.size(); ) {
+            const size_t stop = amino_acids.find('*', part_start);
+            const size_t part_end = stop == std::string::npos ? amino_acids.size() : stop;
+            const auto part_begin = amino_acids.cbegin() + static_cast<std::string::difference_type>(part_start);
+            const auto part_last = amino_acids.cbegin() + static_cast<std::string::difference_type>(part_end);
+            if ((part_end - part_start) >= MINIMUM_SEQUENCE_AA_LENGTH) {
                 Messages messages;
-                auto align_data = align(part, messages);
+                auto align_data = aAligner(part_begin, part_last, messages);
                 if (!align_data.shift.alignment_failed()) {
-                    if (align_data.shift.aligned() && prefix_len > 0) {
-                        align_data.shift -= prefix_len;
+                    if (align_data.shift.aligned() && part_start > 0) {
+                        align_data.shift -= part_start;
                     }
-                    r.push_back(AlignAminoAcidsData(align_data, amino_acids, offset));
+                    if (number_of_results == 0)
+                        result = AlignAminoAcidsData(align_data, std::move(amino_acids), offset);
+                    ++number_of_results;
                     aMessages.add(messages);
                     break;
                 }
                 else {
-                    if (not_aligned.amino_acids.size() < part.size()) {
-                        not_aligned.amino_acids = part;
+                    if (not_aligned.amino_acids.size() < (part_end - part_start)) {
+                        not_aligned.amino_acids.assign(part_begin, part_last);
                         not_aligned.offset = offset;
                     }
                 }
             }
-            prefix_len += 1 + part.size();
+            if (stop == std::string::npos)
+                break;
+            part_start = stop + 1;
         }
     }
-    if (r.empty()) {
+    if (statistics)
+        align_statistics_translate(number_of_results == 0 ? -1 : result.offset, number_of_results, AlignClock::now() - start);
+    if (number_of_results == 0) {
         return not_aligned;
     }
-    if (r.size() > 1)
+    if (number_of_results > 1)
         aMessages.warning() << "Multiple translations and alignment for: " << aNucleotides << std::endl;
-    return r[0];
+    return result;
 
 } // translate_and_align
 
@@ -79,21 +101,28 @@ static const std::map<std::string, char> CODON_TO_PROTEIN = {
     {"TAA", '*'}, {"UAA", '*'}, {"TAG", '*'}, {"UAG", '*'}, {"TGA", '*'}, {"UGA", '*'}, {"TAR", '*'}, {"TRA", '*'}, {"UAR", '*'}, {"URA", '*'},
 };
 
-std::string translate_nucleotides_to_amino_acids(std::string aNucleotides, size_t aOffset, Messages& /*aMessages*/)
+std::string translate_nucleotides_to_amino_acids(const std::string& aNucleotides, size_t aOffset, Messages& /*aMessages*/)
 {
-    typedef decltype(CODON_TO_PROTEIN)::difference_type Diff;
     std::string result;
-    result.resize((aNucleotides.size() - aOffset) / 3 + 1, '-');
-    auto result_p = result.begin();
+    translate_nucleotides_to_amino_acids(aNucleotides, aOffset, result);
+    return result;
+
+} // translate_nucleotides_to_amino_acids
+
+// ----------------------------------------------------------------------
+
+void translate_nucleotides_to_amino_acids(const std::string& aNucleotides, size_t aOffset, std::string& aTarget)
+{
+    aTarget.resize((aNucleotides.size() - aOffset) / 3 + 1, '-');
+    auto result_p = aTarget.begin();
     for (auto offset = aOffset; offset < aNucleotides.size(); offset += 3, ++result_p) {
-        auto const it = CODON_TO_PROTEIN.find(std::string(aNucleotides.begin() + static_cast<Diff>(offset), aNucleotides.begin() + static_cast<Diff>(offset) + 3));
+        auto const it = CODON_TO_PROTEIN.find(aNucleotides.substr(offset, 3)); // codon fits into the short string buffer, no allocation
         if (it != CODON_TO_PROTEIN.end())
             *result_p = it->second;
         else
             *result_p = 'X';
     }
-    result.resize(static_cast<size_t>(result_p - result.begin()));
-    return result;
+    aTarget.resize(static_cast<size_t>(result_p - aTarget.begin()));
 
 } // translate_nucleotides_to_amino_acids
 
@@ -163,48 +192,210 @@ static AlignEntry ALIGN_RAW_DATA[] = {
     {"B", "", "",    Shift(), std::regex("GNFLWLLHV"),                                                           45, false, "B-CNIC"}, // Only CNIC sequences 2008-2009 have it, perhaps not HA
 };
 
-AlignData align(std::string aAminoAcids, Messages& aMessages)
+// ----------------------------------------------------------------------
+
+namespace
+{
+    constexpr size_t NumberOfMotifs = sizeof(ALIGN_RAW_DATA) / sizeof(ALIGN_RAW_DATA[0]);
+
+      // bucket 0: below 1us, bucket N: [2^(N-1), 2^N) us, the last bucket collects everything slower
+    class LatencyHistogram
+    {
+     public:
+        inline void add(AlignClock::duration aLatency)
+            {
+                auto us = std::chrono::duration_cast<std::chrono::microseconds>(aLatency).count();
+                size_t bucket = 0;
+                for (; us > 0 && bucket < (mBuckets.size() - 1); us >>= 1)
+                    ++bucket;
+                ++mBuckets[bucket];
+            }
+
+        inline void reset() { for (auto& bucket: mBuckets) bucket = 0; }
+
+        inline std::string json() const
+            {
+                std::ostringstream out;
+                out << '[';
+                for (size_t bucket = 0; bucket < mBuckets.size(); ++bucket)
+                    out << (bucket ? ", " : "") << mBuckets[bucket];
+                out << ']';
+                return out.str();
+            }
+
+     private:
+        std::array<std::atomic<unsigned long>, 24> mBuckets;
+    };
+
+      // counters are atomic, align() may be called from several threads
+    struct AlignStatistics
+    {
+        std::atomic<bool> enabled;
+
+        std::atomic<unsigned long> align_calls, align_not_aligned, align_multiple_agreeing, align_multiple_conflicting;
+        std::array<std::atomic<unsigned long>, NumberOfMotifs> motif_hits;
+        std::array<std::atomic<unsigned long>, NumberOfMotifs> motif_search_ns;
+        LatencyHistogram align_latency;
+
+        std::atomic<unsigned long> translate_calls, translate_not_aligned, translate_multiple;
+        std::array<std::atomic<unsigned long>, 3> translate_offset;
+        LatencyHistogram translate_latency;
+    };
+
+    AlignStatistics sAlignStatistics; // static storage, all counters are zero initialized
+}
+
+// ----------------------------------------------------------------------
+
+static bool align_statistics_enabled()
 {
-    std::vector<AlignEntry> results;
+    return sAlignStatistics.enabled.load(std::memory_order_relaxed);
+
+} // align_statistics_enabled
+
+// ----------------------------------------------------------------------
+
+static void align_statistics_translate(int aOffset, size_t aNumberOfResults, AlignClock::duration aLatency)
+{
+    ++sAlignStatistics.translate_calls;
+    if (aOffset < 0)
+        ++sAlignStatistics.translate_not_aligned;
+    else
+        ++sAlignStatistics.translate_offset[static_cast<size_t>(aOffset)];
+    if (aNumberOfResults > 1)
+        ++sAlignStatistics.translate_multiple;
+    sAlignStatistics.translate_latency.add(aLatency);
+
+} // align_statistics_translate
+
+// ----------------------------------------------------------------------
+
+void align_statistics_enable(bool aEnable)
+{
+    sAlignStatistics.enabled = aEnable;
+
+} // align_statistics_enable
+
+// ----------------------------------------------------------------------
+
+void align_statistics_reset()
+{
+    auto& st = sAlignStatistics;
+    st.align_calls = st.align_not_aligned = st.align_multiple_agreeing = st.align_multiple_conflicting = 0;
+    for (size_t motif_no = 0; motif_no < NumberOfMotifs; ++motif_no)
+        st.motif_hits[motif_no] = st.motif_search_ns[motif_no] = 0;
+    st.align_latency.reset();
+    st.translate_calls = st.translate_not_aligned = st.translate_multiple = 0;
+    for (auto& offset: st.translate_offset)
+        offset = 0;
+    st.translate_latency.reset();
+
+} // align_statistics_reset
+
+// ----------------------------------------------------------------------
+
+std::string align_statistics_json()
+{
+    const auto& st = sAlignStatistics;
+    std::ostringstream out;
+    out << "{\n"
+        << " \"align\": {\"calls\": " << st.align_calls << ", \"not_aligned\": " << st.align_not_aligned
+        << ", \"multiple_agreeing\": " << st.align_multiple_agreeing << ", \"multiple_conflicting\": " << st.align_multiple_conflicting
+        << ", \"latency_us_log2\": " << st.align_latency.json() << "},\n"
+        << " \"motifs\": [\n";
+    for (size_t motif_no = 0; motif_no < NumberOfMotifs; ++motif_no) {
+        const auto& motif = ALIGN_RAW_DATA[motif_no];
+        out << "  {\"name\": \"" << motif.name << "\", \"subtype\": \"" << motif.subtype << "\", \"gene\": \"" << motif.gene
+            << "\", \"hits\": " << st.motif_hits[motif_no] << ", \"misses\": " << (st.align_calls - st.motif_hits[motif_no])
+            << ", \"search_us\": " << st.motif_search_ns[motif_no] / 1000 << '}' << (motif_no < (NumberOfMotifs - 1) ? "," : "") << '\n';
+    }
+    out << " ],\n"
+        << " \"translate_and_align\": {\"calls\": " << st.translate_calls << ", \"not_aligned\": " << st.translate_not_aligned
+        << ", \"multiple_translations\": " << st.translate_multiple
+        << ", \"offsets\": [" << st.translate_offset[0] << ", " << st.translate_offset[1] << ", " << st.translate_offset[2] << ']'
+        << ", \"latency_us_log2\": " << st.translate_latency.json() << "}\n"
+        << "}\n";
+    return out.str();
+
+} // align_statistics_json
+
+// ----------------------------------------------------------------------
+
+AlignData align(std::string::const_iterator aBegin, std::string::const_iterator aEnd, Messages& aMessages)
+{
+    typedef std::pair<const AlignEntry*, Shift> Result; // entry itself is not copied, it contains regex
+    const size_t size = static_cast<size_t>(aEnd - aBegin);
+    auto write_amino_acids = [aBegin, aEnd](std::ostream& out) -> std::ostream& { std::copy(aBegin, aEnd, std::ostreambuf_iterator<char>(out)); return out; };
+
+    const bool statistics = align_statistics_enabled();
+    const auto start = statistics ? AlignClock::now() : AlignClock::time_point();
+    auto search_start = start;
+    auto record_search = [&](const AlignEntry* aRawData, bool aHit) {
+        const auto now = AlignClock::now();
+        const auto motif_no = static_cast<size_t>(aRawData - std::begin(ALIGN_RAW_DATA));
+        sAlignStatistics.motif_search_ns[motif_no] += static_cast<unsigned long>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - search_start).count());
+        if (aHit)
+            ++sAlignStatistics.motif_hits[motif_no];
+        search_start = now;
+    };
+    auto record_align = [&](std::atomic<unsigned long>* aCounter) {
+        if (statistics) {
+            ++sAlignStatistics.align_calls;
+            if (aCounter)
+                ++*aCounter;
+            sAlignStatistics.align_latency.add(AlignClock::now() - start);
+        }
+    };
+
+    std::vector<Result> results;
     for (auto raw_data = std::begin(ALIGN_RAW_DATA); raw_data != std::end(ALIGN_RAW_DATA); ++raw_data) {
         std::smatch m;
-        if (std::regex_search(aAminoAcids.cbegin(), aAminoAcids.cbegin() + static_cast<std::string::difference_type>(std::min(aAminoAcids.size(), raw_data->endpos)), m, raw_data->re)) {
-            AlignEntry r(*raw_data);
+        const bool hit = std::regex_search(aBegin, aBegin + static_cast<std::string::difference_type>(std::min(size, raw_data->endpos)), m, raw_data->re);
+        if (statistics)
+            record_search(raw_data, hit);
+        if (hit) {
+            Shift shift = raw_data->shift;
             if (raw_data->signalpeptide) {
-                r.shift = - (m[0].second - aAminoAcids.cbegin());
+                shift = - (m[0].second - aBegin);
             }
-            else if (r.shift.aligned()) {
-                r.shift -= m[0].first - aAminoAcids.cbegin();
+            else if (shift.aligned()) {
+                shift -= m[0].first - aBegin;
             }
-            results.push_back(r);
+            results.emplace_back(&*raw_data, shift);
         }
     }
+    auto make_result = [](const Result& aResult) -> AlignData { return AlignData(aResult.first->subtype, aResult.first->lineage, aResult.first->gene, aResult.second); };
     if (results.empty()) {
-        aMessages.warning() << "Not aligned: " << aAminoAcids << std::endl;
+        write_amino_acids(aMessages.warning() << "Not aligned: ") << std::endl;
+        record_align(&sAlignStatistics.align_not_aligned);
         return AlignData();
     }
     else if (results.size() > 1) {
+        bool conflicting = false;
         try {
-            const auto subtypes = std::accumulate(results.begin(), results.end(), std::set<std::string>(), [](auto& a, const auto& e) { a.insert(e.subtype); return a; });
-            const auto shifts = std::accumulate(results.begin(), results.end(), std::set<std::string>(), [](auto& a, const auto& e) { a.insert(e.shift); return a; });
+            const auto subtypes = std::accumulate(results.begin(), results.end(), std::set<std::string>(), [](auto& a, const auto& e) { a.insert(e.first->subtype); return a; });
+            const auto shifts = std::accumulate(results.begin(), results.end(), std::set<std::string>(), [](auto& a, const auto& e) { a.insert(e.second); return a; });
             if (subtypes.size() > 1 || shifts.size() > 1) {
+                conflicting = true;
                 std::ostringstream os;
-                os << "Multiple alignment matches produce different subtypes and/or shifts: " << subtypes << "  " << shifts << std::endl
-                   << "    " << aAminoAcids << std::endl
-                   << "    " << to_stream(results, [](const auto& e) -> std::string { return e.name; });
+                os << "Multiple alignment matches produce different subtypes and/or shifts: " << subtypes << "  " << shifts << std::endl << "    ";
+                write_amino_acids(os) << std::endl
+                   << "    " << to_stream(results, [](const auto& e) -> std::string { return e.first->name; });
                   //std::cerr << os.str() << std::endl;
                 aMessages.warning() << os.str() << std::endl;
             }
         }
         catch (InvalidShift&) {
-            std::cerr << "INTERNAL ERROR: InvalidShift " << aAminoAcids << std::endl;
+            write_amino_acids(std::cerr << "INTERNAL ERROR: InvalidShift ") << std::endl;
         }
-        return results[0];
+        record_align(conflicting ? &sAlignStatistics.align_multiple_conflicting : &sAlignStatistics.align_multiple_agreeing);
+        return make_result(results[0]);
     }
     else {
-        if (results[0].name == "h3-ATL")
-            std::cerr << "%%% " << results[0].name << " " << results[0].shift << " " << aAminoAcids << std::endl;
-        return results[0];
+        if (results[0].first->name == "h3-ATL")
+            write_amino_acids(std::cerr << "%%% " << results[0].first->name << " " << results[0].second << " ") << std::endl;
+        record_align(nullptr);
+        return make_result(results[0]);
     }
 
 } // align
@@ -2,6 +2,9 @@
 
 #include <string>
 #include <set>
+#include <array>
+#include <algorithm>
+#include <functional>
 
 #include "messages.hh"
 #include "sequence-shift.hh"
@@ -27,9 +30,9 @@ struct AlignData
 
 struct AlignAminoAcidsData : public AlignData
 {
-    inline AlignAminoAcidsData() = default;
+    inline AlignAminoAcidsData() : offset(0) {}
     inline AlignAminoAcidsData(const AlignData& aAlignData, std::string aAminoAcids, int aOffset)
-        : AlignData(aAlignData), amino_acids(aAminoAcids), offset(aOffset) {}
+        : AlignData(aAlignData), amino_acids(std::move(aAminoAcids)), offset(aOffset) {}
     inline AlignAminoAcidsData(AlignData&& aAlignData)
         : AlignData(aAlignData), offset(0) {}
     // inline AlignAminoAcidsData(const AlignAminoAcidsData&) = default;
@@ -47,25 +50,53 @@ struct AlignAminoAcidsData : public AlignData
 
 // ----------------------------------------------------------------------
 
-AlignAminoAcidsData translate_and_align(std::string aNucleotides, Messages& aMessages);
+  // aligns [aBegin, aEnd) part of a sequence
+typedef std::function<AlignData (std::string::const_iterator aBegin, std::string::const_iterator aEnd, Messages& aMessages)> Aligner;
 
-std::string translate_nucleotides_to_amino_acids(std::string aNucleotides, size_t aOffset, Messages& aMessages);
-AlignData align(std::string aAminoAcids, Messages& aMessages);
+AlignAminoAcidsData translate_and_align(const std::string& aNucleotides, Messages& aMessages, const Aligner& aAligner);
+
+std::string translate_nucleotides_to_amino_acids(const std::string& aNucleotides, size_t aOffset, Messages& aMessages);
+  // translates into aTarget reusing its storage
+void translate_nucleotides_to_amino_acids(const std::string& aNucleotides, size_t aOffset, std::string& aTarget);
+
+  // aligns [aBegin, aEnd) part of a sequence without copying it
+AlignData align(std::string::const_iterator aBegin, std::string::const_iterator aEnd, Messages& aMessages);
+
+inline AlignData align(const std::string& aAminoAcids, Messages& aMessages)
+{
+    return align(aAminoAcids.cbegin(), aAminoAcids.cend(), aMessages);
+}
+
+  // translates and aligns using ALIGN_RAW_DATA motifs
+inline AlignAminoAcidsData translate_and_align(const std::string& aNucleotides, Messages& aMessages)
+{
+    return translate_and_align(aNucleotides, aMessages, static_cast<AlignData (*)(std::string::const_iterator, std::string::const_iterator, Messages&)>(&align));
+}
+
+  // Optional instrumentation of align() and translate_and_align(), disabled by default:
+  // per motif hit counters and regex search time, frame offsets, latency histograms.
+void align_statistics_enable(bool aEnable);
+void align_statistics_reset();
+std::string align_statistics_json();
 
 // ----------------------------------------------------------------------
 
-inline AlignAminoAcidsData align_amino_acids(std::string aAminoAcids, Messages& aMessages)
+inline AlignAminoAcidsData align_amino_acids(const std::string& aAminoAcids, Messages& aMessages)
 {
     return AlignAminoAcidsData(align(aAminoAcids, aMessages));
 }
 
 // ----------------------------------------------------------------------
 
-inline bool is_nucleotides(std::string aSequence)
+inline bool is_nucleotides(const std::string& aSequence)
 {
-    constexpr char sNucleotideElements[] = "-ABCDGHKMNRSTUVWY"; // https://en.wikipedia.org/wiki/Nucleic_acid_notation
-    const std::set<char> elements(aSequence.begin(), aSequence.end());
-    return std::includes(std::begin(sNucleotideElements), std::end(sNucleotideElements), elements.begin(), elements.end());
+    static const auto sNucleotideElements = [] {
+        std::array<bool, 256> elements{};
+        for (const char* element = "-ABCDGHKMNRSTUVWY"; *element; ++element) // https://en.wikipedia.org/wiki/Nucleic_acid_notation
+            elements[static_cast<unsigned char>(*element)] = true;
+        return elements;
+    }();
+    return std::all_of(aSequence.begin(), aSequence.end(), [](char aElement) { return sNucleotideElements[static_cast<unsigned char>(aElement)]; });
 }
 
 // ----------------------------------------------------------------------
@@ -8,7 +8,6 @@
 
 DrawTree& DrawTree::prepare(Tree& aTree, const SettingsDrawTree& aSettings)
 {
-    add_hz_line_sections_gap(aTree, aSettings.hz_line_sections);
     aTree.prepare_for_drawing(aSettings);
     mNumberOfLines = aTree.height();
 
@@ -23,22 +22,6 @@ DrawTree& DrawTree::prepare(Tree& aTree, const SettingsDrawTree& aSettings)
 
 // ----------------------------------------------------------------------
 
-void DrawTree::add_hz_line_sections_gap(Tree& aTree, const HzLineSections& aSections)
-{
-    if (aSections.vertical_gap > 0) {
-        for (size_t section_no = 1; section_no < aSections.size(); ++section_no) {
-            auto& section = aSections[section_no];
-            const auto node = aTree.find_node_by_name(section.first_name);
-            if (node == nullptr)
-                throw std::runtime_error("Cannot process hz-line-section: \"" + section.first_name + "\" not found in the tree");
-            node->vertical_gap_before = aSections.vertical_gap;
-        }
-    }
-
-} // DrawTree::add_hz_line_sections_gap
-
-// ----------------------------------------------------------------------
-
 void DrawTree::calculate_viewports(const Tree& aTree, const Viewport& aViewport)
 {
     mViewport = aViewport;
@@ -57,7 +40,41 @@ void DrawTree::draw(const Tree& aTree, Surface& aSurface, const Viewport& aViewp
     set_horizontal_step(aSurface, aTree, aViewport, aSettings);
 
     draw_grid(aSurface, aViewport, aSettings);
-    draw_node(aTree, aSurface, aViewport.origin, aSettings, aSettings.root_edge);
+
+    const auto& tree_index = aTree.index();
+
+      // vertical positions in lines: leaf is at its line, subtree vertical line spans from the middle of its first visible child to the middle of the last one
+    std::vector<double> middle(tree_index.size(), 0.0), top(tree_index.size(), 0.0), bottom(tree_index.size(), 0.0);
+    for (auto no = tree_index.size(); no > 0; --no) {
+        const auto node_no = no - 1;
+        if (tree_index.is_leaf(node_no)) {
+            middle[node_no] = tree_index.node(node_no).line_no;
+        }
+        else if (!tree_index.node(node_no).hidden) {
+            top[node_no] = -1;
+            for (auto child_no = tree_index.first_child(node_no); child_no != TreeIndex::NoNode; child_no = tree_index.next_sibling(child_no)) {
+                if (!tree_index.node(child_no).hidden) {
+                    bottom[node_no] = middle[child_no];
+                    if (top[node_no] < 0)
+                        top[node_no] = bottom[node_no];
+                }
+            }
+            middle[node_no] = (top[node_no] + bottom[node_no]) / 2.0;
+        }
+    }
+
+    std::vector<double> right(tree_index.size(), 0.0); // right side of the node, i.e. left side of its children
+    for (TreeIndex::NodeNo no = 0; no < tree_index.size(); ) {
+        const auto& node = tree_index.node(no);
+        if (node.hidden) {
+            no = tree_index.subtree_end(no);
+        }
+        else {
+            const double left = no == 0 ? aViewport.origin.x : right[tree_index.parent(no)];
+            right[no] = draw_node(node, aSurface, Location(left, aViewport.origin.y), aSettings, middle[no], top[no], bottom[no], no == 0 ? aSettings.root_edge : -1.0);
+            ++no;
+        }
+    }
 
     mark_nodes(aSurface);
       // aSurface.line(aViewport.origin, aViewport.bottom_right(), 0xFF00A5, 5, CAIRO_LINE_CAP_ROUND);
@@ -66,40 +83,35 @@ void DrawTree::draw(const Tree& aTree, Surface& aSurface, const Viewport& aViewp
 
 // ----------------------------------------------------------------------
 
-void DrawTree::draw_node(const Node& aNode, Surface& aSurface, const Location& aOrigin, const SettingsDrawTree& aSettings, double aEdgeLength)
+double DrawTree::draw_node(const Node& aNode, Surface& aSurface, const Location& aOrigin, const SettingsDrawTree& aSettings, double aMiddle, double aTop, double aBottom, double aEdgeLength)
 {
+    const Viewport viewport(Location(aOrigin.x, aOrigin.y + mVerticalStep * aMiddle),
+                            Size((aEdgeLength < 0.0 ? aNode.edge_length : aEdgeLength) * mHorizontalStep, 0));
     if (!aNode.hidden) {
-        const Viewport viewport(Location(aOrigin.x, aOrigin.y + mVerticalStep * aNode.middle()),
-                                Size((aEdgeLength < 0.0 ? aNode.edge_length : aEdgeLength) * mHorizontalStep, 0));
-
         aSurface.line(viewport.origin, viewport.top_right(), aSettings.line_color, mLineWidth);
         draw_aa_transition(aNode, aSurface, viewport, aSettings.aa_transition);
-        if (!aNode.hidden) {
-            if (aNode.is_leaf()) {
-                const std::string text = aNode.display_name();
-                const auto font_size = mVerticalStep * mLabelScale;
-                const auto tsize = aSurface.text_size(text, font_size, aSettings.label_style);
-                const auto text_origin = viewport.top_right() + Size(aSettings.name_offset, tsize.height / 2);
-                aSurface.text(text_origin, text, mColoring->color(aNode), font_size, aSettings.label_style);
-                auto mark_node = mNodesToMark.find(aNode.name);
-                if (mark_node != mNodesToMark.end())
-                    mark_node->second.set(text_origin, aNode);
-            }
-            else {
-                  // if (aShowBranchIds && !aNode.branch_id.empty()) {
-                  //     show_branch_id(aSurface, aNode.branch_id, aLeft, y);
-                  // }
-                  // if (!aNode.name.empty() && aNode.number_strains > aNumberStrainsThreshold) {
-                  //     show_branch_annotation(aSurface, aNode.branch_id, aNode.name, aLeft, right, y);
-                  // }
-                aSurface.line({viewport.right(), aOrigin.y + mVerticalStep * aNode.top}, {viewport.right(), aOrigin.y + mVerticalStep * aNode.bottom}, aSettings.line_color, mLineWidth);
-                  // draw_aa_transition(aNode, aSurface, viewport, aSettings.aa_transition);
-                for (auto node = aNode.subtree.begin(); node != aNode.subtree.end(); ++node) {
-                    draw_node(*node, aSurface, Location(viewport.right(), aOrigin.y), aSettings);
-                }
-            }
+        if (aNode.is_leaf()) {
+            const std::string text = aNode.display_name();
+            const auto font_size = mVerticalStep * mLabelScale;
+            const auto tsize = aSurface.text_size(text, font_size, aSettings.label_style);
+            const auto text_origin = viewport.top_right() + Size(aSettings.name_offset, tsize.height / 2);
+            aSurface.text(text_origin, text, mColoring->color(aNode), font_size, aSettings.label_style);
+            auto mark_node = mNodesToMark.find(aNode.name);
+            if (mark_node != mNodesToMark.end())
+                mark_node->second.set(text_origin, aNode);
+        }
+        else {
+              // if (aShowBranchIds && !aNode.branch_id.empty()) {
+              //     show_branch_id(aSurface, aNode.branch_id, aLeft, y);
+              // }
+              // if (!aNode.name.empty() && aNode.number_strains > aNumberStrainsThreshold) {
+              //     show_branch_annotation(aSurface, aNode.branch_id, aNode.name, aLeft, right, y);
+              // }
+            aSurface.line({viewport.right(), aOrigin.y + mVerticalStep * aTop}, {viewport.right(), aOrigin.y + mVerticalStep * aBottom}, aSettings.line_color, mLineWidth);
+              // draw_aa_transition(aNode, aSurface, viewport, aSettings.aa_transition);
         }
     }
+    return viewport.right();
 
 } // DrawTree::draw_node
 
@@ -231,23 +243,32 @@ void DrawTree::set_horizontal_step(Surface& aSurface, const Tree& aTree, const V
 
 double DrawTree::tree_width(Surface& aSurface, const Node& aNode, const SettingsDrawTree& aSettings, double aEdgeLength) const
 {
-    if (aNode.hidden)
-        return 0;
-
-    double r = 0;
-    const double right = (aEdgeLength < 0.0 ? aNode.edge_length : aEdgeLength) * mHorizontalStep;
-    if (aNode.is_leaf()) {
-        auto const font_size = mVerticalStep * mLabelScale;
-        r = aSurface.text_size(aNode.display_name(), font_size, aSettings.label_style).width + aSettings.name_offset;
-    }
-    else {
-        for (auto node = aNode.subtree.begin(); node != aNode.subtree.end(); ++node) {
-            const double node_r = tree_width(aSurface, *node, aSettings);
-            if (node_r > r)
-                r = node_r;
+    auto const font_size = mVerticalStep * mLabelScale;
+    auto right = [&](const Node& node) -> double { return ((&node == &aNode && aEdgeLength >= 0.0) ? aEdgeLength : node.edge_length) * mHorizontalStep; };
+
+    std::vector<double> widths{0.0}; // the widest child of each subtree being visited, the bottom one is the result
+    auto leaf = [&](const Node& node) {
+        if (!node.hidden) {
+            const double r = aSurface.text_size(node.display_name(), font_size, aSettings.label_style).width + aSettings.name_offset + right(node);
+            if (r > widths.back())
+                widths.back() = r;
         }
-    }
-    return r + right;
+        return Iterate::Continue;
+    };
+    auto subtree_pre = [&widths](const Node& node) {
+        if (node.hidden)
+            return Iterate::SkipSubtree;
+        widths.push_back(0.0);
+        return Iterate::Continue;
+    };
+    auto subtree_post = [&](const Node& node) {
+        const double r = widths.back() + right(node);
+        widths.pop_back();
+        if (r > widths.back())
+            widths.back() = r;
+    };
+    iterate_tree(aNode, leaf, subtree_pre, subtree_post);
+    return widths.front();
 
 } // DrawTree::tree_width
 
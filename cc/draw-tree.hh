@@ -40,13 +40,13 @@ class DrawTree
     double mLabelScale;
     size_t mNumberOfLines;
 
-    Viewport mViewport;         // to avoid passing via draw_node recusrsive calls
+    Viewport mViewport;         // to avoid passing to draw_node
 
-    void add_hz_line_sections_gap(Tree& aTree, const HzLineSections& aSections);
     void set_label_scale(Surface& surface, const Tree& aTree, const Viewport& aViewport, const SettingsDrawTree& aSettings);
     void set_horizontal_step(Surface& surface, const Tree& aTree, const Viewport& aViewport, const SettingsDrawTree& aSettings);
     double tree_width(Surface& surface, const Node& aNode, const SettingsDrawTree& aSettings, double aEdgeLength = -1.0) const;
-    void draw_node(const Node& aNode, Surface& surface, const Location& aOrigin, const SettingsDrawTree& aSettings, double aEdgeLength = -1.0);
+      // draws one node (without its children) at the passed vertical position (in lines), returns right side of the node (left side of its children)
+    double draw_node(const Node& aNode, Surface& surface, const Location& aOrigin, const SettingsDrawTree& aSettings, double aMiddle, double aTop, double aBottom, double aEdgeLength = -1.0);
     void draw_aa_transition(const Node& aNode, Surface& aSurface, const Viewport& aViewport, const SettingsAATransition& aSettings);
     void draw_grid(Surface& aSurface, const Viewport& aViewport, const SettingsDrawTree& aSettings);
     void mark_nodes(Surface& aSurface);
@@ -0,0 +1,318 @@
+#include <fstream>
+#include <array>
+#include <map>
+#include <regex>
+#include <cstring>
+#include <lzma.h>
+
+#include "fasta-export.hh"
+#include "string.hh"
+
+// ----------------------------------------------------------------------
+
+namespace
+{
+      // plain file, stdout or xz compressed file, nothing is kept in memory besides the compression buffer
+    class Output
+    {
+     public:
+        Output(std::string aFilename);
+        ~Output();
+
+        void write(const char* aData, size_t aSize);
+        inline Output& operator<<(const std::string& aData) { write(aData.data(), aData.size()); return *this; }
+        inline Output& operator<<(char aData) { write(&aData, 1); return *this; }
+        void close();
+
+     private:
+        std::ofstream mFile;
+        std::ostream* mStream;
+        bool mXz;
+        bool mClosed;
+        lzma_stream mLzma;
+        std::array<uint8_t, 65536> mBuffer;
+
+        void xz_code(lzma_action aAction);
+    };
+
+    struct Record
+    {
+        SeqdbEntrySeq entry_seq;
+        std::string name;
+        std::string date;
+        std::string sequence;
+    };
+
+    std::string make_name(std::string aFormat, const SeqdbEntrySeq& aEntrySeq);
+    Record make_record(const SeqdbExportSettings& aSettings, const SeqdbEntrySeq& aEntrySeq, size_t aLeftPartSize);
+    size_t most_common_length(const std::vector<Record>& aRecords);
+}
+
+// ----------------------------------------------------------------------
+
+std::pair<size_t, std::string> export_sequences(std::string aFilename, const Seqdb& aSeqdb, const std::vector<SeqdbEntrySeq>& aSelected, const SeqdbExportSettings& aSettings)
+{
+    if (aSettings.format == SeqdbExportSettings::Format::Phylip && aSettings.wrap)
+        throw std::runtime_error("phylip with wrapping is not supported");
+
+    size_t left_part_size = 0;
+    if (aSettings.aligned && !aSettings.truncate_left) {
+        for (const auto& entry_seq: aSelected)
+            left_part_size = std::max(left_part_size, static_cast<size_t>(std::max(0, - (aSettings.amino_acids ? entry_seq.seq().amino_acids_shift() : entry_seq.seq().nucleotides_shift()))));
+        if (left_part_size)
+            std::cerr << "INFO: Left part size (signal peptide): " << left_part_size << std::endl;
+    }
+
+    std::vector<Record> records;
+    records.reserve(aSelected.size() + 1);
+    for (const auto& entry_seq: aSelected) {
+        records.push_back(make_record(aSettings, entry_seq, left_part_size));
+        if (records.back().sequence.empty()) {
+            std::cerr << "WARNING: sequence is empty and is not exported: " << records.back().name << std::endl;
+            records.pop_back();
+        }
+    }
+    if (records.empty())
+        throw std::runtime_error("No sequences found for exporting");
+
+      // avoid repeated names
+    std::stable_sort(records.begin(), records.end(), [](const auto& a, const auto& b) { return a.name < b.name; });
+    size_t repeat_no = 0;
+    for (auto previous = records.begin(), current = previous + 1; current != records.end(); ++current) {
+        if (current->name == previous->name) {
+            current->name += "__" + std::to_string(++repeat_no);
+        }
+        else {
+            previous = current;
+            repeat_no = 0;
+        }
+    }
+
+    if (aSettings.sort_by == "date")
+        std::stable_sort(records.begin(), records.end(), [](const auto& a, const auto& b) { return a.date < b.date; });
+    else if (!aSettings.sort_by.empty() && aSettings.sort_by != "name")
+        throw std::runtime_error("Unrecognized sort_by argument: " + aSettings.sort_by);
+
+      // base seq is always the first one in the file, regardless of sorting, to ease specifying the outgroup for GARLI
+    std::string base_seq_name;
+    if (!aSettings.base_seq.empty()) {
+        const std::regex base_seq_re(aSettings.base_seq, std::regex::icase);
+        std::vector<SeqdbEntrySeq> base_seqs;
+        std::copy_if(aSeqdb.begin(), aSeqdb.end(), std::back_inserter(base_seqs), [&base_seq_re](const auto& entry_seq) { return std::regex_search(entry_seq.make_name(), base_seq_re); });
+        if (base_seqs.size() != 1) {
+            std::string names;
+            for (const auto& entry_seq: base_seqs)
+                names += " \"" + entry_seq.make_name() + "\"";
+            throw std::runtime_error(std::to_string(base_seqs.size()) + " base sequences selected:" + names);
+        }
+        auto base = make_record(aSettings, base_seqs[0], left_part_size);
+        records.erase(std::remove_if(records.begin(), records.end(), [&base](const auto& record) { return record.name == base.name; }), records.end());
+        records.insert(records.begin(), std::move(base));
+        base_seq_name = fasta_encode_name(records.front().name);
+    }
+
+    if (aSettings.truncate_to_most_common_length) {
+        const auto length = most_common_length(records);
+        std::cerr << "INFO: Truncating/extending sequences to the most common length: " << length << std::endl;
+        for (auto& record: records)
+            record.sequence.resize(length, aSettings.amino_acids ? 'X' : '-');
+    }
+
+    if (records.size() < 2)
+        throw std::runtime_error("Too few (" + std::to_string(records.size()) + ") sequences found for exporting");
+
+    Output output(aFilename);
+      // stripped after encoding, e.g. "{name} {passage}" with an empty passage
+    auto name = [&aSettings](const Record& aRecord) { return string::strip(aSettings.encode_name ? fasta_encode_name(aRecord.name) : aRecord.name); };
+    switch (aSettings.format) {
+      case SeqdbExportSettings::Format::Fasta:
+          for (const auto& record: records) {
+              output << '>' << name(record) << '\n';
+              constexpr size_t chunk = 60;
+              if (aSettings.wrap) {
+                  for (size_t pos = 0; pos < record.sequence.size(); pos += chunk) {
+                      output.write(record.sequence.data() + pos, std::min(chunk, record.sequence.size() - pos));
+                      output << '\n';
+                  }
+              }
+              else {
+                  output << record.sequence << '\n';
+              }
+          }
+          break;
+      case SeqdbExportSettings::Format::Phylip: {
+          size_t max_sequence_length = 0, max_name_length = 0;
+          for (const auto& record: records) {
+              max_sequence_length = std::max(max_sequence_length, record.sequence.size());
+              max_name_length = std::max(max_name_length, name(record).size());
+          }
+          output << std::to_string(records.size()) << ' ' << std::to_string(max_sequence_length) << '\n';
+          for (const auto& record: records) {
+              const auto record_name = name(record);
+              output << record_name << std::string(max_name_length - record_name.size() + 2, ' ') << record.sequence << std::string(max_sequence_length - record.sequence.size(), '-') << '\n';
+          }
+      }
+          break;
+    }
+    output.close();
+    return {records.size(), base_seq_name};
+
+} // export_sequences
+
+// ----------------------------------------------------------------------
+
+std::string fasta_encode_name(std::string aName)
+{
+    constexpr const char* to_encode = "% :()!*';@&=+$,?#[]";
+    constexpr const char* hex = "0123456789ABCDEF";
+    std::string result;
+    result.reserve(aName.size());
+    for (char c: aName) {
+        if (std::strchr(to_encode, c) != nullptr && c != 0) {
+            result += '%';
+            result += hex[(static_cast<unsigned char>(c) >> 4) & 0xF];
+            result += hex[static_cast<unsigned char>(c) & 0xF];
+        }
+        else {
+            result += c;
+        }
+    }
+    return result;
+
+} // fasta_encode_name
+
+// ----------------------------------------------------------------------
+
+namespace
+{
+    Output::Output(std::string aFilename)
+        : mStream(&std::cout), mXz(false), mClosed(false), mLzma(LZMA_STREAM_INIT)
+    {
+        if (aFilename != "-") {
+            mFile.open(aFilename, std::ios::binary);
+            if (!mFile)
+                throw std::runtime_error("Cannot open " + aFilename + " for writing");
+            mStream = &mFile;
+            mXz = aFilename.size() > 3 && aFilename.substr(aFilename.size() - 3) == ".xz";
+            if (mXz && lzma_easy_encoder(&mLzma, 6, LZMA_CHECK_CRC64) != LZMA_OK)
+                throw std::runtime_error("lzma initialization failed");
+        }
+        std::cerr << "INFO: Writing " << aFilename << std::endl;
+    }
+
+    Output::~Output()
+    {
+        try {
+            close();
+        }
+        catch (std::exception& err) {
+            std::cerr << "ERROR: " << err.what() << std::endl;
+        }
+        if (mXz)
+            lzma_end(&mLzma);
+    }
+
+    void Output::write(const char* aData, size_t aSize)
+    {
+        if (mXz) {
+            mLzma.next_in = reinterpret_cast<const uint8_t*>(aData);
+            mLzma.avail_in = aSize;
+            xz_code(LZMA_RUN);
+        }
+        else {
+            mStream->write(aData, static_cast<std::streamsize>(aSize));
+        }
+    }
+
+    void Output::close()
+    {
+        if (!mClosed) {
+            mClosed = true;
+            if (mXz)
+                xz_code(LZMA_FINISH);
+            mStream->flush();
+            if (!*mStream)
+                throw std::runtime_error("Writing failed");
+        }
+    }
+
+    void Output::xz_code(lzma_action aAction)
+    {
+        for (;;) {
+            mLzma.next_out = mBuffer.data();
+            mLzma.avail_out = mBuffer.size();
+            const auto ret = lzma_code(&mLzma, aAction);
+            if (ret != LZMA_OK && ret != LZMA_STREAM_END)
+                throw std::runtime_error("lzma compression failed: " + std::to_string(ret));
+            mStream->write(reinterpret_cast<const char*>(mBuffer.data()), static_cast<std::streamsize>(mBuffer.size() - mLzma.avail_out));
+            if (ret == LZMA_STREAM_END || (aAction == LZMA_RUN && mLzma.avail_in == 0 && mLzma.avail_out != 0))
+                break;
+        }
+    }
+
+// ----------------------------------------------------------------------
+
+      // python str.format subset: fields without format specs, {{ and }}
+    std::string make_name(std::string aFormat, const SeqdbEntrySeq& aEntrySeq)
+    {
+        std::string result;
+        for (size_t pos = 0; pos < aFormat.size(); ++pos) {
+            const char c = aFormat[pos];
+            if ((c == '{' || c == '}') && (pos + 1) < aFormat.size() && aFormat[pos + 1] == c) {
+                result += c;
+                ++pos;
+            }
+            else if (c == '{') {
+                const auto end = aFormat.find('}', pos);
+                if (end == std::string::npos)
+                    throw std::runtime_error("Invalid name_format: " + aFormat);
+                const auto field = aFormat.substr(pos + 1, end - pos - 1);
+                if (field == "name")
+                    result += aEntrySeq.make_name();
+                else if (field == "date")
+                    result += aEntrySeq.entry().date();
+                else if (field == "lab_id")
+                    result += aEntrySeq.seq().lab_id();
+                else if (field == "passage")
+                    result += aEntrySeq.seq().passage();
+                else if (field == "lab")
+                    result += aEntrySeq.seq().lab();
+                else if (field == "gene")
+                    result += aEntrySeq.seq().gene();
+                else if (field == "seq_id")
+                    result += aEntrySeq.seq_id();
+                else
+                    throw std::runtime_error("Unrecognized name_format field: " + field);
+                pos = end;
+            }
+            else {
+                result += c;
+            }
+        }
+        return result;
+    }
+
+    Record make_record(const SeqdbExportSettings& aSettings, const SeqdbEntrySeq& aEntrySeq, size_t aLeftPartSize)
+    {
+        const auto& seq = aEntrySeq.seq();
+        return {aEntrySeq, make_name(aSettings.name_format, aEntrySeq), aEntrySeq.entry().date(),
+                aSettings.amino_acids ? seq.amino_acids(aSettings.aligned, aLeftPartSize) : seq.nucleotides(aSettings.aligned, aLeftPartSize)};
+    }
+
+      // the first one of the most common in case of ties, like collections.Counter.most_common
+    size_t most_common_length(const std::vector<Record>& aRecords)
+    {
+        std::map<size_t, size_t> counts;
+        std::vector<size_t> order;
+        for (const auto& record: aRecords) {
+            if (counts[record.sequence.size()]++ == 0)
+                order.push_back(record.sequence.size());
+        }
+        return *std::max_element(order.begin(), order.end(), [&counts](size_t a, size_t b) { return counts[a] < counts[b]; });
+    }
+}
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "seqdb.hh"
+
+// ----------------------------------------------------------------------
+
+// Native counterpart of python/seqdb/fasta.py export_from_seqdb: names
+// are made by name_format, repeated names get __<n> suffixes, sequences
+// are optionally padded with the left part (signal peptide), truncated
+// or extended to the most common length, base sequence goes first.
+// Output is written as it is produced to a file, to stdout ("-"), or to
+// an xz compressed stream if the filename ends with .xz.
+
+struct SeqdbExportSettings
+{
+    enum class Format { Fasta, Phylip };
+
+    Format format = Format::Fasta;
+    bool amino_acids = false;
+    bool aligned = true;
+    bool truncate_left = true;
+    std::string name_format = "{name} {passage}"; // fields: {name} {date} {lab_id} {passage} {lab} {gene} {seq_id}
+    bool encode_name = false;
+    bool wrap = true;                             // 60 symbols per line, fasta only
+    bool truncate_to_most_common_length = false;
+    std::string sort_by = "date";                 // "date", "name" or empty (names order)
+    std::string base_seq;                         // regex to select base sequence in the whole seqdb, empty - no base sequence
+};
+
+  // returns number of sequences written and encoded name of the base sequence (empty if there is no base sequence)
+std::pair<size_t, std::string> export_sequences(std::string aFilename, const Seqdb& aSeqdb, const std::vector<SeqdbEntrySeq>& aSelected, const SeqdbExportSettings& aSettings);
+
+  // replaces % :()!*';@&=+$,?#[] with %XX
+std::string fasta_encode_name(std::string aName);
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
@@ -0,0 +1,405 @@
+#include <iostream>
+#include <fstream>
+#include <array>
+#include <algorithm>
+#include <regex>
+#include <functional>
+#include <cstring>
+#include <lzma.h>
+#include <bzlib.h>
+
+#include "fasta-read.hh"
+#include "string.hh"
+
+// ----------------------------------------------------------------------
+
+namespace
+{
+      // reads file by chunks, xz and bz2 (detected by content) are decompressed on the fly
+    class DecompressingReader
+    {
+     public:
+        DecompressingReader(std::string aFilename);
+        ~DecompressingReader();
+
+          // returns false at the end of file, line does not include \n (and \r)
+        bool getline(std::string& aLine);
+
+     private:
+        enum class Compression { None, Xz, Bz2 };
+
+        std::string mFilename;
+        std::ifstream mFile;
+        Compression mCompression;
+        lzma_stream mLzma;
+        bz_stream mBz;
+        std::array<char, 65536> mInput;
+        std::array<char, 262144> mOutput;
+        size_t mInputAvailable;
+        const char* mInputNext;
+        std::string mPending;
+        size_t mPendingPos;
+        bool mEof;
+
+        bool read_input();
+        bool fill();
+    };
+
+    class NameParser
+    {
+     public:
+        NameParser();
+        FastaRecord parse(std::string aRawName, std::string aLab) const;
+
+     private:
+        typedef std::function<FastaRecord (const std::string&, const std::smatch&, std::string)> Handler;
+        std::vector<std::pair<std::regex, Handler>> mParsers;
+    };
+
+    void check_sequence(const std::string& aSequence, const std::string& aName, const std::string& aFilename, size_t aLineNo);
+}
+
+// ----------------------------------------------------------------------
+
+std::vector<FastaRecord> read_fasta_with_name_parsing(std::string aFilename, std::string aLab, std::string aVirusType)
+{
+    static const NameParser name_parser;
+
+    std::vector<FastaRecord> result;
+    DecompressingReader reader(aFilename);
+    std::string line, raw_name, sequence;
+    size_t line_no = 0;
+    auto make_record = [&]() {
+        check_sequence(sequence, raw_name, aFilename, line_no);
+        auto parsed = name_parser.parse(raw_name, aLab);
+        if (parsed.empty())
+            throw FastaReaderError("Cannot parse name: \"" + raw_name + "\"");
+        FastaRecord record{{"sequence", sequence}};
+        if (!aLab.empty())
+            record["lab"] = aLab;
+        if (!aVirusType.empty())
+            record["virus_type"] = aVirusType;
+        for (auto& field: parsed)
+            record[field.first] = std::move(field.second);
+        result.push_back(std::move(record));
+    };
+
+    while (reader.getline(line)) {
+        ++line_no;
+        if (line.empty() || line[0] == ';') {
+              // empty or comment line
+        }
+        else if (line[0] == '>') {
+            if (!raw_name.empty() || !sequence.empty())
+                make_record();
+            sequence.clear();
+            raw_name = string::strip(line.substr(1));
+        }
+        else {
+            if (raw_name.empty())
+                throw FastaReaderError(aFilename + ":" + std::to_string(line_no) + ": sequence without name");
+            for (char c: line)
+                sequence += c == '/' ? '-' : static_cast<char>(std::toupper(static_cast<unsigned char>(c))); // / found in H1pdm sequences
+        }
+    }
+    if (!raw_name.empty())
+        make_record();
+    return result;
+
+} // read_fasta_with_name_parsing
+
+// ----------------------------------------------------------------------
+
+FastaRecord parse_fasta_name(std::string aRawName, std::string aLab)
+{
+    static const NameParser name_parser;
+    return name_parser.parse(aRawName, aLab);
+
+} // parse_fasta_name
+
+// ----------------------------------------------------------------------
+
+namespace
+{
+    DecompressingReader::DecompressingReader(std::string aFilename)
+        : mFilename(aFilename), mFile(aFilename, std::ios::binary), mCompression(Compression::None), mLzma(LZMA_STREAM_INIT), mBz(),
+          mInputAvailable(0), mInputNext(mInput.data()), mPendingPos(0), mEof(false)
+    {
+        if (!mFile)
+            throw FastaReaderError("Cannot open " + aFilename);
+        read_input();
+        const unsigned char xz_magic[] = {0xFD, '7', 'z', 'X', 'Z', 0x00};
+        if (mInputAvailable >= sizeof(xz_magic) && std::memcmp(mInputNext, xz_magic, sizeof(xz_magic)) == 0) {
+            if (lzma_stream_decoder(&mLzma, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+                throw FastaReaderError("lzma decoder initialization failed");
+            mCompression = Compression::Xz;
+        }
+        else if (mInputAvailable >= 3 && std::memcmp(mInputNext, "BZh", 3) == 0) {
+            if (BZ2_bzDecompressInit(&mBz, 0, 0) != BZ_OK)
+                throw FastaReaderError("bzip2 decoder initialization failed");
+            mCompression = Compression::Bz2;
+        }
+    }
+
+    DecompressingReader::~DecompressingReader()
+    {
+        switch (mCompression) {
+          case Compression::Xz:
+              lzma_end(&mLzma);
+              break;
+          case Compression::Bz2:
+              BZ2_bzDecompressEnd(&mBz);
+              break;
+          case Compression::None:
+              break;
+        }
+    }
+
+    bool DecompressingReader::read_input()
+    {
+        mFile.read(mInput.data(), static_cast<std::streamsize>(mInput.size()));
+        mInputAvailable = static_cast<size_t>(mFile.gcount());
+        mInputNext = mInput.data();
+        return mInputAvailable > 0;
+    }
+
+      // appends next portion of the decompressed data to mPending, returns false if there is no more data
+    bool DecompressingReader::fill()
+    {
+        if (mEof)
+            return false;
+        if (mInputAvailable == 0 && !read_input() && mCompression == Compression::None) {
+            mEof = true;
+            return false;
+        }
+        switch (mCompression) {
+          case Compression::None:
+              mPending.append(mInputNext, mInputAvailable);
+              mInputAvailable = 0;
+              break;
+          case Compression::Xz: {
+              mLzma.next_in = reinterpret_cast<const uint8_t*>(mInputNext);
+              mLzma.avail_in = mInputAvailable;
+              mLzma.next_out = reinterpret_cast<uint8_t*>(mOutput.data());
+              mLzma.avail_out = mOutput.size();
+              const auto ret = lzma_code(&mLzma, mInputAvailable == 0 ? LZMA_FINISH : LZMA_RUN);
+              mInputNext = reinterpret_cast<const char*>(mLzma.next_in);
+              mInputAvailable = mLzma.avail_in;
+              mPending.append(mOutput.data(), mOutput.size() - mLzma.avail_out);
+              if (ret == LZMA_STREAM_END)
+                  mEof = true;
+              else if (ret == LZMA_BUF_ERROR)
+                  throw FastaReaderError(mFilename + ": unexpected end of xz data");
+              else if (ret != LZMA_OK)
+                  throw FastaReaderError(mFilename + ": xz decompression failed: " + std::to_string(ret));
+          }
+              break;
+          case Compression::Bz2: {
+              if (mInputAvailable == 0)
+                  throw FastaReaderError(mFilename + ": unexpected end of bz2 data");
+              mBz.next_in = const_cast<char*>(mInputNext);
+              mBz.avail_in = static_cast<unsigned>(mInputAvailable);
+              mBz.next_out = mOutput.data();
+              mBz.avail_out = static_cast<unsigned>(mOutput.size());
+              const auto ret = BZ2_bzDecompress(&mBz);
+              mInputNext = mBz.next_in;
+              mInputAvailable = mBz.avail_in;
+              mPending.append(mOutput.data(), mOutput.size() - mBz.avail_out);
+              if (ret == BZ_STREAM_END) {
+                    // multistream files (e.g. made by pbzip2) have several concatenated streams
+                  BZ2_bzDecompressEnd(&mBz);
+                  if (mInputAvailable == 0 && !read_input()) {
+                      mCompression = Compression::None;
+                      mEof = true;
+                  }
+                  else if (BZ2_bzDecompressInit(&mBz, 0, 0) != BZ_OK) {
+                      mCompression = Compression::None;
+                      throw FastaReaderError("bzip2 decoder initialization failed");
+                  }
+              }
+              else if (ret != BZ_OK) {
+                  throw FastaReaderError(mFilename + ": bz2 decompression failed: " + std::to_string(ret));
+              }
+          }
+              break;
+        }
+        return true;
+    }
+
+    bool DecompressingReader::getline(std::string& aLine)
+    {
+        for (;;) {
+            const auto eol = mPending.find('\n', mPendingPos);
+            if (eol != std::string::npos) {
+                aLine.assign(mPending, mPendingPos, eol - mPendingPos);
+                mPendingPos = eol + 1;
+                break;
+            }
+            if (mPendingPos > 0) { // keep only incomplete line
+                mPending.erase(0, mPendingPos);
+                mPendingPos = 0;
+            }
+            if (!fill()) {
+                if (mPending.empty())
+                    return false;
+                aLine = std::move(mPending);
+                mPending.clear();
+                break;
+            }
+        }
+        if (!aLine.empty() && aLine.back() == '\r')
+            aLine.pop_back();
+        return true;
+    }
+
+// ----------------------------------------------------------------------
+
+      // the same as ^[A-Za-z\-~:\*\.]+$ in fasta.py, std::regex is recursive and overflows stack on long sequences
+    void check_sequence(const std::string& aSequence, const std::string& aName, const std::string& aFilename, size_t aLineNo)
+    {
+        if (aSequence.empty())
+            throw FastaReaderError(aFilename + ":" + std::to_string(aLineNo) + ": \"" + aName + "\" without sequence");
+        if (std::find_if(aSequence.begin(), aSequence.end(), [](char c) { return !std::isalpha(static_cast<unsigned char>(c)) && (c == 0 || std::strchr("-~:*.", c) == nullptr); }) != aSequence.end())
+            throw FastaReaderError(aFilename + ":" + std::to_string(aLineNo) + ": invalid sequence read: " + aSequence);
+    }
+
+// ----------------------------------------------------------------------
+
+    inline std::string replace_all(std::string aSource, const std::string& aLook, const std::string& aReplacement)
+    {
+        for (auto pos = aSource.find(aLook); pos != std::string::npos; pos = aSource.find(aLook, pos + aReplacement.size()))
+            aSource.replace(pos, aLook.size(), aReplacement);
+        return aSource;
+    }
+
+    std::string fix_gisaid_lab(std::string aLab)
+    {
+        for (const auto& replacement: {std::make_pair("Centers for Disease Control and Prevention", "CDC"),
+                    std::make_pair("Crick Worldwide Influenza Centre", "NIMR"),
+                    std::make_pair("National Institute for Medical Research", "NIMR"),
+                    std::make_pair("WHO Collaborating Centre for Reference and Research on Influenza", "MELB"),
+                    std::make_pair("National Institute of Infectious Diseases (NIID)", "NIID"),
+                    std::make_pair("National Institute of Infectious Diseases", "NIID"),
+                    std::make_pair("Erasmus Medical Center", "EMC")}) {
+            aLab = replace_all(aLab, replacement.first, replacement.second);
+        }
+        return aLab;
+    }
+
+    std::string fix_gisaid_virus_type(std::string aVirusType)
+    {
+        static const std::regex re_virus_type("^\\s*([AB])\\s*/\\s*(H\\d+N\\d+)\\s*$");
+        if (!aVirusType.empty()) {
+            std::smatch m;
+            if (!std::regex_match(aVirusType, m, re_virus_type))
+                throw std::invalid_argument("Unrecognized gisaid flu virus_type: " + aVirusType);
+            aVirusType = m.str(1) == "B" ? std::string("B") : "A(" + m.str(2) + ")";
+        }
+        return aVirusType;
+    }
+
+      // group numbers of the named groups of the python regexes
+    struct GisaidGroups
+    {
+        size_t name, year1, month1, day1, year2, month2, year3, passage, lab_id, lab, virus_type, lineage;
+    };
+
+    FastaRecord gisaid(const std::smatch& m, const GisaidGroups& g, bool aWithDate, std::string aLab)
+    {
+        static const std::regex re_cdcid("^\\s*(\\d{8,10})(?:_\\d{6}_v\\d(?:_\\d)?|_\\d|\\s+.*)?$");
+        auto group = [&m](size_t no) { return no ? m.str(no) : std::string(); };
+        const std::string year = aWithDate ? (!group(g.year1).empty() ? group(g.year1) : (!group(g.year2).empty() ? group(g.year2) : group(g.year3))) : std::string();
+        if (g.lab)
+            aLab = fix_gisaid_lab(group(g.lab));
+        std::string lab_id = group(g.lab_id);
+        if (aLab == "CDC" && !lab_id.empty()) {
+            std::smatch m_cdcid;
+            if (std::regex_match(lab_id, m_cdcid, re_cdcid)) {
+                lab_id = m_cdcid.str(1);
+            }
+            else {
+                std::cerr << "WARNING: Not a cdcid: " << lab_id << std::endl;
+                lab_id.clear();
+            }
+        }
+        std::string date;
+        if (!year.empty()) {
+            const std::string month = !group(g.month1).empty() ? group(g.month1) : (!group(g.month2).empty() ? group(g.month2) : std::string("01"));
+            date = year + "-" + month + "-" + (!group(g.day1).empty() ? group(g.day1) : std::string("01"));
+        }
+        return {{"name", group(g.name)}, {"date", date}, {"passage", group(g.passage)}, {"lab_id", lab_id}, {"lab", aLab},
+                {"virus_type", fix_gisaid_virus_type(group(g.virus_type))}, {"lineage", group(g.lineage)}};
+    }
+
+    NameParser::NameParser()
+    {
+        const auto flags = std::regex::ECMAScript | std::regex::icase | std::regex::optimize;
+        const std::string date = "(?:(\\d+)-(\\d+)-(\\d+)|(\\d+)-(\\d+)\\s+\\(day unknown\\)|(\\d+)\\s+\\(month and day unknown\\))";
+        auto add = [this, flags](std::string aRe, Handler aHandler) { mParsers.emplace_back(std::regex(aRe, flags), aHandler); };
+        auto add_gisaid = [&add](std::string aRe, GisaidGroups aGroups, bool aWithDate) {
+            add(aRe, [aGroups, aWithDate](const std::string&, const std::smatch& m, std::string aLab) { return gisaid(m, aGroups, aWithDate, aLab); });
+        };
+        auto name_passage = [](const std::string&, const std::smatch& m, std::string) -> FastaRecord { return {{"name", string::upper(m.str(1))}, {"passage", m.str(2)}}; };
+        auto name_only = [](const std::string&, const std::smatch& m, std::string) -> FastaRecord { return {{"name", string::upper(m.str(1))}}; };
+
+          // name | date | passage | lab_id | lab | virus_type | lineage
+        add_gisaid("^([^|]+)\\s+\\|\\s+" + date + "\\s+\\|\\s+([^\\|]*)\\s+\\|\\s+([^\\|]*)?\\s+\\|\\s+([A-Za-z ]+)\\s+\\|\\s+([AB]\\s*/\\s*H\\d+N\\d+)\\s+\\|\\s*([A-Za-z0-9]+)?\\s*$",
+                   {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12}, true);
+          // name | date | passage | lab_id | lab
+        add_gisaid("^([^|]+)\\s+\\|\\s+" + date + "\\s+\\|\\s+([^\\|]*)\\s+\\|\\s+([^\\|]*)?\\s+\\|\\s+([A-Za-z ]+)\\s*$", {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0, 0}, true);
+          // name | date | passage | lab_id | something-else
+        add_gisaid("^([^|]+)\\s+\\|\\s+" + date + "\\s+\\|\\s+([^\\|]+)\\s+\\|\\s+([^\\|]+)?\\s+\\|.*$", {1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 0, 0}, true);
+          // name | date | passage? | lab_id
+        add_gisaid("^([^|]+)\\s+\\|\\s+" + date + "\\s+\\|\\s+([^\\|]+)?\\s*\\|\\s*(.+)?\\s*$", {1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 0, 0}, true);
+          // name1 | gene | designation | name | passage | flu_type
+        add("^(EPI\\d+)\\s+\\|\\s+(HA|NA)\\s+\\|\\s+([^\\|]+)\\s+\\|\\s+(EPI_[A-Z_0-9]+)\\s+\\|\\s*([^\\s]+)?\\s*\\|\\s*(.+)?\\s*$",
+            [](const std::string&, const std::smatch& m, std::string) -> FastaRecord { return {{"name", m.str(4)}, {"gene", m.str(2)}}; });
+          // nimr 20090914
+        add("^([^\\s]+)\\s+PileUp\\sof", name_only);
+          // cdc 20100913: name | passage | fasta_id
+        add("^([^|]+)\\s+\\|\\s+([^\\s]+)\\s*\\|\\s+((?:EPI|201)\\d+)\\s*$",
+            [](const std::string&, const std::smatch& m, std::string) -> FastaRecord { return {{"name", string::upper(m.str(3))}, {"passage", m.str(2)}}; });
+          // gisaid without date: name | passage | lab_id
+        add_gisaid("^([^|]+)\\s+\\|\\s+([^\\s]+)\\s+\\|\\s*(.+)?\\s*$", {1, 0, 0, 0, 0, 0, 0, 2, 3, 0, 0, 0}, false);
+          // melb 20100823: name  date  passage
+        add("^([^\\s]+)\\s\\s+([\\d/]+)\\s\\s+([^\\s]+)\\s*$",
+            [](const std::string&, const std::smatch& m, std::string) -> FastaRecord { return {{"name", string::upper(m.str(1))}, {"date", m.str(2)}, {"passage", m.str(3)}}; });
+          // melb 20110921
+        add("^(\\d+S\\d+)\\s+\"Contig\\s+\\d+\"\\s+\\(\\d+,\\d+\\)$", name_only);
+          // CNIC
+        add("^([^_]+/\\d\\d\\d\\d)[\\s_]+[^/]*(?:[\\s_]?:([EC]\\d*))[^/]*$", name_passage);
+        add("^([^_]+/\\d\\d\\d\\d)[\\s_]+(?:Jan|Feb|Mar|Apr|may|Jun|Jul|Aug|Sep|Oct|Nov|Dec)?[^/]*$", name_only);
+          // CDC
+        add("^([^\\s]+_4)$", name_only);
+          // CNIC
+        add("^([^_]+)[\\s_]+[^/]*$", name_only);
+          // NIID
+        add("^(.+/\\d\\d\\d\\d)[\\s\\-]*([\\.\\dA-Z]+)?$", name_passage);
+          // anything else
+        add("^.", [](const std::string& aRawName, const std::smatch&, std::string) -> FastaRecord { return {{"name", aRawName}}; });
+    }
+
+    FastaRecord NameParser::parse(std::string aRawName, std::string aLab) const
+    {
+        FastaRecord result;
+        for (const auto& parser: mParsers) {
+            std::smatch m;
+            if (std::regex_search(aRawName, m, parser.first)) {
+                result = parser.second(aRawName, m, aLab);
+                for (auto field = result.begin(); field != result.end(); ) {
+                    if (field->second.empty())
+                        field = result.erase(field);
+                    else
+                        ++field;
+                }
+                break;
+            }
+        }
+        return result;
+    }
+}
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+
+// ----------------------------------------------------------------------
+
+// Native counterpart of read_fasta_with_name_parsing in
+// python/seqdb/fasta.py. File is decompressed (xz, bz2) while being
+// read, names are parsed with the same set of formats (gisaid, cdc,
+// melb, nimr, cnic, niid). Each record contains only non-empty fields
+// of: name, date, passage, lab_id, lab, virus_type, lineage, gene,
+// sequence.
+
+typedef std::map<std::string, std::string> FastaRecord;
+
+class FastaReaderError : public std::runtime_error
+{
+ public:
+    using std::runtime_error::runtime_error;
+};
+
+  // aLab and aVirusType are used for the records which names do not provide them
+std::vector<FastaRecord> read_fasta_with_name_parsing(std::string aFilename, std::string aLab, std::string aVirusType);
+
+  // returns fields parsed from the fasta name line (without >), empty fields are not included
+FastaRecord parse_fasta_name(std::string aRawName, std::string aLab);
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
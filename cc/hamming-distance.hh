@@ -0,0 +1,106 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <thread>
+
+// ----------------------------------------------------------------------
+
+// Number of positions where aligned sequences differ, compared up to the
+// length of the shorter one. Eight positions are compared at once: bytes
+// of the xor of two words are zero where sequences are equal.
+// Comparison stops as soon as the distance exceeds aLimit, any value
+// greater than aLimit is returned then.
+
+inline size_t hamming_distance(const std::string& s1, const std::string& s2, size_t aLimit)
+{
+    constexpr uint64_t low7 = 0x7F7F7F7F7F7F7F7FULL;
+    const size_t size = std::min(s1.size(), s2.size());
+    const char* p1 = s1.data();
+    const char* p2 = s2.data();
+    size_t result = 0;
+    size_t pos = 0;
+    for (; (pos + sizeof(uint64_t)) <= size; pos += sizeof(uint64_t)) {
+        uint64_t w1, w2;
+        std::memcpy(&w1, p1 + pos, sizeof(w1));
+        std::memcpy(&w2, p2 + pos, sizeof(w2));
+        const uint64_t diff = w1 ^ w2;
+          // high bit of each byte is set iff the byte of diff is not zero
+        const uint64_t nonzero = (((diff & low7) + low7) | diff) & ~low7;
+        result += static_cast<size_t>(__builtin_popcountll(nonzero));
+        if (result > aLimit)
+            return result;
+    }
+    for (; pos < size; ++pos) {
+        if (p1[pos] != p2[pos])
+            ++result;
+    }
+    return result;
+
+} // hamming_distance
+
+inline size_t hamming_distance(const std::string& s1, const std::string& s2)
+{
+    return hamming_distance(s1, s2, std::numeric_limits<size_t>::max());
+}
+
+// ----------------------------------------------------------------------
+
+inline std::vector<size_t> hamming_distances(const std::string& aBase, const std::vector<std::string>& aSequences)
+{
+    std::vector<size_t> result(aSequences.size());
+    std::transform(aSequences.begin(), aSequences.end(), result.begin(), [&aBase](const auto& seq) { return hamming_distance(aBase, seq); });
+    return result;
+
+} // hamming_distances
+
+// ----------------------------------------------------------------------
+
+  // all pairs, row-major matrix: result[i * aSequences.size() + j]
+  // rows are processed in aThreads threads (0 - number of cores), each thread gets rows with about the same number of
+  // pairs (row i has pairs with columns after i), every pair is computed once by one thread and stored at both places
+inline std::vector<size_t> hamming_distance_matrix(const std::vector<std::string>& aSequences, size_t aThreads = 1)
+{
+    const size_t size = aSequences.size();
+    std::vector<size_t> result(size * size, 0);
+    auto make_rows = [&](size_t aFirstRow, size_t aLastRow) {
+        for (size_t row = aFirstRow; row < aLastRow; ++row) {
+            for (size_t col = row + 1; col < size; ++col)
+                result[row * size + col] = result[col * size + row] = hamming_distance(aSequences[row], aSequences[col]);
+        }
+    };
+
+    if (aThreads == 0)
+        aThreads = std::max(1U, std::thread::hardware_concurrency());
+    aThreads = std::max(size_t(1), std::min(aThreads, size));
+    if (aThreads == 1) {
+        make_rows(0, size);
+    }
+    else {
+        const size_t pairs = size * (size - 1) / 2;
+        std::vector<size_t> first_row(aThreads + 1, size); // rows first_row[thread_no]..first_row[thread_no + 1] are processed by thread_no
+        first_row[0] = 0;
+        size_t row = 0, pairs_before_row = 0;
+        for (size_t thread_no = 1; thread_no < aThreads; ++thread_no) {
+            while (row < size && pairs_before_row < pairs * thread_no / aThreads)
+                pairs_before_row += size - 1 - row++;
+            first_row[thread_no] = row;
+        }
+        std::vector<std::thread> workers;
+        for (size_t thread_no = 0; thread_no < aThreads; ++thread_no)
+            workers.emplace_back(make_rows, first_row[thread_no], first_row[thread_no + 1]);
+        for (auto& worker: workers)
+            worker.join();
+    }
+    return result;
+
+} // hamming_distance_matrix
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
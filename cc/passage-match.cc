@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <stdexcept>
+
+#include "passage-match.hh"
+
+// ----------------------------------------------------------------------
+
+constexpr size_t PassageMatcher::ReassortantMismatch;
+
+// ----------------------------------------------------------------------
+
+size_t PassageMatcher::level(const std::string& aSeqPassage, const std::vector<std::string>& aSeqReassortant, const std::string& aHiPassage, const std::string& aHiReassortant)
+{
+    if (std::find(aSeqReassortant.begin(), aSeqReassortant.end(), aHiReassortant) == aSeqReassortant.end())
+        return ReassortantMismatch; // reassortants do not match, not consider at all
+    if (aSeqPassage.empty())
+        return aHiPassage == "X?" ? 89 : 90;
+    if (aHiPassage.empty())
+        return 91;
+    if (aSeqPassage == aHiPassage)
+        return 0;
+
+    const auto& seq = tokens(aSeqPassage);
+    const auto& hi = tokens(aHiPassage);
+    if (seq.parts.empty() || hi.parts.empty())
+        return 110;
+    if (seq.parts == hi.parts)
+        return (seq.date && hi.date) ? 11 : 10; // matches without date: dates differ or one of them is missing
+
+      // compares parts from the end, aBase if the last ones are the same, one less for each preceding same pair
+    const size_t common = std::min(seq.parts.size(), hi.parts.size());
+    auto from_end = [common](const std::vector<std::string>& aSeq, const std::vector<std::string>& aHi, size_t aBase) -> size_t {
+        if (aSeq.back() != aHi.back())
+            return 0;
+        size_t result = aBase;
+        for (size_t no = 2; no <= common && aSeq[aSeq.size() - no] == aHi[aHi.size() - no]; ++no)
+            --result;
+        return result;
+    };
+    if (const auto same_parts = from_end(seq.parts, hi.parts, 20))
+        return same_parts;
+    if (const auto same_types = from_end(seq.types, hi.types, 30))
+        return same_types;
+    if (const auto close_types = from_end(seq.close_types, hi.close_types, 40))
+        return close_types;
+    return 100;
+
+} // PassageMatcher::level
+
+// ----------------------------------------------------------------------
+
+std::vector<PassageMatcher::Match> PassageMatcher::match(const std::vector<std::vector<std::string>>& aSeqPassages, const std::vector<std::vector<std::string>>& aSeqReassortants,
+                                                         const std::vector<std::string>& aHiPassages, const std::vector<std::string>& aHiReassortants)
+{
+    if (aSeqPassages.size() != aSeqReassortants.size() || aHiPassages.size() != aHiReassortants.size())
+        throw std::invalid_argument("PassageMatcher::match: number of passages and reassortants differ");
+
+    std::vector<size_t> seq_left(aSeqPassages.size()), hi_left(aHiPassages.size());
+    std::iota(seq_left.begin(), seq_left.end(), 0);
+    std::iota(hi_left.begin(), hi_left.end(), 0);
+    std::vector<Match> result;
+    while (!seq_left.empty() && !hi_left.empty()) {
+          // the first best in the order of seq groups, their passages, hi variants
+        size_t best_level = std::numeric_limits<size_t>::max(), best_seq = 0, best_passage = 0, best_hi = 0;
+        for (size_t seq_no = 0; seq_no < seq_left.size(); ++seq_no) {
+            const auto& passages = aSeqPassages[seq_left[seq_no]];
+            for (size_t passage_no = 0; passage_no < passages.size(); ++passage_no) {
+                for (size_t hi_no = 0; hi_no < hi_left.size(); ++hi_no) {
+                    const auto lev = level(passages[passage_no], aSeqReassortants[seq_left[seq_no]], aHiPassages[hi_left[hi_no]], aHiReassortants[hi_left[hi_no]]);
+                    if (lev < best_level) {
+                        best_level = lev;
+                        best_seq = seq_no;
+                        best_passage = passage_no;
+                        best_hi = hi_no;
+                    }
+                }
+            }
+        }
+        if (best_level == std::numeric_limits<size_t>::max())
+            break;              // seq groups without passages
+        result.emplace_back(seq_left[best_seq], best_passage, hi_left[best_hi], best_level);
+        if (best_level < ReassortantMismatch)
+            hi_left.erase(hi_left.begin() + static_cast<std::vector<size_t>::difference_type>(best_hi));
+        seq_left.erase(seq_left.begin() + static_cast<std::vector<size_t>::difference_type>(best_seq));
+    }
+    return result;
+
+} // PassageMatcher::match
+
+// ----------------------------------------------------------------------
+
+// Up to 10 parts [A-Z]+[\d\?]* optionally separated by /, then optional " (YYYY-MM-DD)"
+const PassageMatcher::Tokens& PassageMatcher::tokens(const std::string& aPassage)
+{
+    auto found = mTokens.find(aPassage);
+    if (found == mTokens.end()) {
+        Tokens result;
+        auto upper = [](char c) { return c >= 'A' && c <= 'Z'; };
+        auto digit = [](char c) { return c >= '0' && c <= '9'; };
+        auto space = [](char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v'; };
+        size_t pos = 0;
+        while (result.parts.size() < 10 && pos < aPassage.size() && upper(aPassage[pos])) {
+            const size_t start = pos;
+            while (pos < aPassage.size() && upper(aPassage[pos]))
+                ++pos;
+            const std::string type = aPassage.substr(start, pos - start);
+            while (pos < aPassage.size() && (digit(aPassage[pos]) || aPassage[pos] == '?'))
+                ++pos;
+            result.parts.push_back(aPassage.substr(start, pos - start));
+            result.types.push_back(type);
+            result.close_types.push_back(type == "SIAT" ? std::string("MDCK") : type);
+            if (pos < aPassage.size() && aPassage[pos] == '/')
+                ++pos;
+        }
+          // (\d+-\d+-\d+)
+        while (pos < aPassage.size() && space(aPassage[pos]))
+            ++pos;
+        if (pos < aPassage.size() && aPassage[pos] == '(') {
+            ++pos;
+            bool valid = true;
+            for (size_t number = 0; valid && number < 3; ++number) {
+                const size_t start = pos;
+                while (pos < aPassage.size() && digit(aPassage[pos]))
+                    ++pos;
+                valid = pos > start && pos < aPassage.size() && aPassage[pos] == (number < 2 ? '-' : ')');
+                ++pos;
+            }
+            result.date = valid;
+        }
+        found = mTokens.emplace(aPassage, std::move(result)).first;
+    }
+    return found->second;
+
+} // PassageMatcher::tokens
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <tuple>
+#include <unordered_map>
+
+// ----------------------------------------------------------------------
+
+// Matching seq passages/reassortants against hidb antigen variants, the
+// same levels as the former HiDb._match_level in python/seqdb/hidb.py
+// (lower is better): 0 - same passage, 9..11 - same passage parts
+// (dates differ or missing), 19..20 - same last passages, 29..30 - same
+// passage types (letters), 39..40 - close passage types (SIAT is MDCK),
+// 89..91 - one of the passages is empty, 100 - different passages, 110 -
+// passage cannot be split, ReassortantMismatch - not a match at all.
+// Passages are split into parts once and cached.
+
+class PassageMatcher
+{
+ public:
+    static constexpr size_t ReassortantMismatch = 99999;
+
+      // seq_group_no, passage_no (in the seq group), hi_variant_no, level
+    typedef std::tuple<size_t, size_t, size_t, size_t> Match;
+
+    size_t level(const std::string& aSeqPassage, const std::vector<std::string>& aSeqReassortant, const std::string& aHiPassage, const std::string& aHiReassortant);
+
+      // Each seq group (passages and reassortants of one SeqdbSeq) is matched to at most one hi variant, each hi variant is
+      // used at most once. Best matching pair is selected among all remaining seq groups and hi variants at each round.
+      // Rounds where the best level is ReassortantMismatch are also reported (seq group is dropped, hi variant is not).
+    std::vector<Match> match(const std::vector<std::vector<std::string>>& aSeqPassages, const std::vector<std::vector<std::string>>& aSeqReassortants,
+                             const std::vector<std::string>& aHiPassages, const std::vector<std::string>& aHiReassortants);
+
+ private:
+    struct Tokens
+    {
+        std::vector<std::string> parts; // e.g. MDCK1, SIAT2 for MDCK1/SIAT2
+        std::vector<std::string> types; // e.g. MDCK, SIAT
+        std::vector<std::string> close_types; // SIAT replaced with MDCK
+        bool date = false;
+    };
+
+    std::unordered_map<std::string, Tokens> mTokens;
+
+    const Tokens& tokens(const std::string& aPassage);
+
+}; // class PassageMatcher
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
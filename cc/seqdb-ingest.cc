@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <unordered_set>
+
+#include "seqdb-ingest.hh"
+
+// ----------------------------------------------------------------------
+
+SeqdbIngest::SeqdbIngest(const std::vector<File>& aFiles, size_t aThreads)
+    : mFiles(aFiles), mSlots(aFiles.size()), mNext(0), mToRead(0), mStop(false)
+{
+    if (aThreads == 0)
+        aThreads = std::max(1U, std::thread::hardware_concurrency());
+    aThreads = std::min(aThreads, mFiles.size());
+    mLookahead = aThreads * 2;
+    for (size_t thread_no = 0; thread_no < aThreads; ++thread_no)
+        mWorkers.emplace_back(&SeqdbIngest::work, this);
+
+} // SeqdbIngest::SeqdbIngest
+
+// ----------------------------------------------------------------------
+
+SeqdbIngest::~SeqdbIngest()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mSpace.notify_all();
+    for (auto& worker: mWorkers)
+        worker.join();
+
+} // SeqdbIngest::~SeqdbIngest
+
+// ----------------------------------------------------------------------
+
+std::vector<FastaRecord> SeqdbIngest::next()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (mNext >= mFiles.size())
+        throw std::out_of_range("SeqdbIngest::next: all " + std::to_string(mFiles.size()) + " files already returned");
+    mReady.wait(lock, [this]() { return mSlots[mNext].ready; });
+    Slot slot = std::move(mSlots[mNext]);
+    ++mNext;
+    lock.unlock();
+    mSpace.notify_all();
+
+    mCurrent.clear();
+    if (slot.error)
+        std::rethrow_exception(slot.error);
+    mCurrent = std::move(slot.prepared);
+    return std::move(slot.records);
+
+} // SeqdbIngest::next
+
+// ----------------------------------------------------------------------
+
+std::string SeqdbIngest::add_sequences(Seqdb& aSeqdb, const std::vector<FastaRecord>& aRecords, bool aCheckNames)
+{
+    auto prepared = std::move(mCurrent);
+    mCurrent.clear();
+    return aSeqdb.add_sequences(aRecords, aCheckNames, &prepared);
+
+} // SeqdbIngest::add_sequences
+
+// ----------------------------------------------------------------------
+
+void SeqdbIngest::work()
+{
+    for (;;) {
+        size_t file_no;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mSpace.wait(lock, [this]() { return mStop || mToRead >= mFiles.size() || mToRead < (mNext + mLookahead); });
+            if (mStop || mToRead >= mFiles.size())
+                break;
+            file_no = mToRead++;
+        }
+
+        Slot slot;
+        try {
+            const auto& file = mFiles[file_no];
+            slot.records = read_fasta_with_name_parsing(file.filename, file.lab, file.virus_type);
+            slot.prepared.resize(slot.records.size());
+            std::unordered_set<std::string> seen;
+            for (size_t record_no = 0; record_no < slot.records.size(); ++record_no) {
+                const auto& record = slot.records[record_no];
+                const auto gene = record.find("gene");
+                  // repeated sequence most probably updates seq added by the first occurrence, it is not prepared (and is aligned by add_sequences if necessary)
+                if (seen.insert(record.at("sequence")).second)
+                    slot.prepared[record_no] = prepare_sequence(record.at("sequence"), gene == record.end() ? std::string() : gene->second);
+            }
+        }
+        catch (...) {
+            slot.error = std::current_exception();
+        }
+        slot.ready = true;
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mSlots[file_no] = std::move(slot);
+        }
+        mReady.notify_all();
+    }
+
+} // SeqdbIngest::work
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
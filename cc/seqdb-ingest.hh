@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+#include "seqdb.hh"
+#include "fasta-read.hh"
+
+// ----------------------------------------------------------------------
+
+// Reads fasta files (read_fasta_with_name_parsing) and translates and
+// aligns their sequences (prepare_sequence) in worker threads, a few
+// files ahead of the consumer. Files are handed out by next() strictly
+// in the order given and seqdb is modified by the consumer thread only
+// (add_sequences), so the result is the same as when reading and adding
+// files one by one.
+
+class SeqdbIngest
+{
+ public:
+    struct File
+    {
+        std::string filename;
+        std::string lab;
+        std::string virus_type;
+    };
+
+    SeqdbIngest(const std::vector<File>& aFiles, size_t aThreads = 0); // aThreads == 0: number of cores
+    ~SeqdbIngest();
+
+    inline size_t number_of_files() const { return mFiles.size(); }
+    inline size_t number_of_threads() const { return mWorkers.size(); }
+
+      // blocks until the next file is read and its sequences are aligned, returns its records, rethrows exception raised while reading the file
+    std::vector<FastaRecord> next();
+      // adds records returned by the last next() call (perhaps normalized, but in the same order) to aSeqdb using sequences aligned in advance, returns messages
+    std::string add_sequences(Seqdb& aSeqdb, const std::vector<FastaRecord>& aRecords, bool aCheckNames);
+
+ private:
+    struct Slot
+    {
+        bool ready = false;
+        std::vector<FastaRecord> records;
+        std::vector<SeqdbSeqPrepared> prepared;
+        std::exception_ptr error;
+    };
+
+    std::vector<File> mFiles;
+    std::vector<Slot> mSlots;
+    size_t mNext;               // file no to be returned by next()
+    size_t mToRead;             // file no to be taken by a worker
+    size_t mLookahead;          // max number of files read but not yet returned by next()
+    bool mStop;
+    std::mutex mMutex;
+    std::condition_variable mReady;
+    std::condition_variable mSpace;
+    std::vector<std::thread> mWorkers;
+    std::vector<SeqdbSeqPrepared> mCurrent;
+
+    void work();
+
+}; // class SeqdbIngest
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
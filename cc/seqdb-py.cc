@@ -21,6 +21,14 @@
 namespace py = pybind11;
 
 #include "seqdb.hh"
+#include "amino-acid-profile.hh"
+#include "hamming-distance.hh"
+#include "sequence-clusters.hh"
+#include "sequence-sketch.hh"
+#include "fasta-export.hh"
+#include "fasta-read.hh"
+#include "seqdb-ingest.hh"
+#include "passage-match.hh"
 #include "tree-import.hh"
 #include "draw.hh"
 #include "draw-tree.hh"
@@ -63,6 +71,38 @@ struct PySeqdbEntrySeqIterator
     inline PySeqdbEntrySeqIterator& filter_hi_name(bool aHasHiName) { mCurrent.filter_hi_name(aHasHiName); return *this; }
     inline PySeqdbEntrySeqIterator& filter_name_regex(std::string aNameRegex) { mCurrent.filter_name_regex(aNameRegex); return *this; }
 
+    inline std::pair<size_t, std::string> export_sequences(std::string aFilename, std::string aOutputFormat, bool aAminoAcids, bool aAligned, bool aTruncateLeft, std::string aNameFormat, bool aEncodeName, bool aWrap, bool aMostCommonLength, std::string aSortBy, std::string aBaseSeq) const
+        {
+            SeqdbExportSettings settings;
+            if (aOutputFormat == "phylip")
+                settings.format = SeqdbExportSettings::Format::Phylip;
+            else if (aOutputFormat != "fasta")
+                throw std::runtime_error("Unrecognized output_format: " + aOutputFormat);
+            settings.amino_acids = aAminoAcids;
+            settings.aligned = aAligned;
+            settings.truncate_left = aTruncateLeft;
+            settings.name_format = aNameFormat;
+            settings.encode_name = aEncodeName;
+            settings.wrap = aWrap;
+            settings.truncate_to_most_common_length = aMostCommonLength;
+            settings.sort_by = aSortBy;
+            settings.base_seq = aBaseSeq;
+            return ::export_sequences(aFilename, mCurrent.seqdb(), std::vector<SeqdbEntrySeq>(mCurrent, mEnd), settings);
+        }
+
+    inline AminoAcidProfile aa_profile() const { AminoAcidProfile profile; profile.add(mCurrent, mEnd); return profile; }
+
+    inline std::vector<std::pair<SeqdbEntrySeq, size_t>> hamming_distances(std::string aBase, bool aAminoAcids) const
+        {
+            std::vector<std::pair<SeqdbEntrySeq, size_t>> result;
+            for (auto current = mCurrent; current != mEnd; ++current) {
+                const auto entry_seq = *current;
+                if (entry_seq.seq().aligned())
+                    result.emplace_back(entry_seq, hamming_distance(aBase, aAminoAcids ? entry_seq.seq().amino_acids_aligned() : entry_seq.seq().nucleotides_aligned()));
+            }
+            return result;
+        }
+
     py::object mRef; // keep a reference
     SeqdbIterator mCurrent;
     SeqdbIterator mEnd;
@@ -177,6 +217,24 @@ PYBIND11_PLUGIN(seqdb_backend)
             .def("filter_date_range", &PySeqdbEntrySeqIterator::filter_date_range)
             .def("filter_hi_name", &PySeqdbEntrySeqIterator::filter_hi_name)
             .def("filter_name_regex", &PySeqdbEntrySeqIterator::filter_name_regex)
+            .def("hamming_distances", &PySeqdbEntrySeqIterator::hamming_distances, py::arg("base"), py::arg("amino_acids") = true, py::doc("returns list of (entry_seq, hamming distance to base) for the aligned sequences selected, the iterator itself is not advanced."))
+            .def("export_sequences", &PySeqdbEntrySeqIterator::export_sequences, py::arg("filename"), py::arg("output_format") = std::string("fasta"), py::arg("amino_acids") = false, py::arg("aligned") = true, py::arg("truncate_left") = true,
+                 py::arg("name_format") = std::string("{name} {passage}"), py::arg("encode_name") = false, py::arg("wrap") = true, py::arg("truncate_to_most_common_length") = false, py::arg("sort_by") = std::string("date"), py::arg("base_seq") = std::string(),
+                 py::doc("writes selected sequences to fasta or phylip file (.xz compressed if filename ends with .xz, stdout if filename is \"-\"), returns (number_of_sequences, encoded base_seq name)."))
+            .def("aa_profile", &PySeqdbEntrySeqIterator::aa_profile, py::doc("returns per position residue counts of the aligned amino acids of the selected sequences, the iterator itself is not advanced."))
+            ;
+
+    py::class_<AminoAcidProfile>(m, "AminoAcidProfile", py::buffer_protocol())
+            .def_buffer([](AminoAcidProfile& profile) -> py::buffer_info {
+                    return py::buffer_info(const_cast<AminoAcidProfile::Count*>(profile.data()), sizeof(AminoAcidProfile::Count), py::format_descriptor<AminoAcidProfile::Count>::format(), 2,
+                                           {profile.number_of_positions(), AminoAcidProfile::NumberOfResidues},
+                                           {sizeof(AminoAcidProfile::Count) * AminoAcidProfile::NumberOfResidues, sizeof(AminoAcidProfile::Count)});
+                })
+            .def("residues", &AminoAcidProfile::residues, py::doc("order of residues in the columns of the profile matrix."))
+            .def("number_of_positions", &AminoAcidProfile::number_of_positions)
+            .def("number_of_sequences", &AminoAcidProfile::number_of_sequences)
+            .def("count", &AminoAcidProfile::count, py::arg("pos"), py::arg("aa"), py::doc("pos is 0-based."))
+            .def("consensus", &AminoAcidProfile::consensus)
             ;
 
     py::class_<PySeqdbEntryIterator>(m, "PySeqdbEntryIterator")
@@ -199,6 +257,8 @@ PYBIND11_PLUGIN(seqdb_backend)
             .def("find_by_name", static_cast<SeqdbEntry* (Seqdb::*)(std::string)>(&Seqdb::find_by_name), py::arg("name"), py::return_value_policy::reference, py::doc("returns entry found by name or None"))
             .def("new_entry", &Seqdb::new_entry, py::arg("name"), py::return_value_policy::reference, py::doc("creates and inserts into the database new entry with the passed name, returns that name, throws if database already has entry with that name."))
             .def("cleanup", &Seqdb::cleanup, py::arg("remove_short_sequences") = true)
+            .def("add_sequences", [](Seqdb& aSeqdb, const std::vector<FastaRecord>& aRecords, bool aCheckNames) { return aSeqdb.add_sequences(aRecords, aCheckNames); }, py::arg("records"), py::arg("check_names") = true, py::doc("adds list of dicts {\"name\":, \"sequence\":, ...} (see read_fasta_with_name_parsing) to the database, returns messages."))
+            .def("align_with_references", &Seqdb::align_with_references, py::doc("aligns sequences not aligned by motifs against the longest aligned sequence of each subtype/lineage/gene, returns messages."))
             .def("report", &Seqdb::report)
             .def("report_identical", &Seqdb::report_identical)
             .def("report_not_aligned", &Seqdb::report_not_aligned, py::arg("prefix_size"), py::doc("returns report with AA prefixes of not aligned sequences."))
@@ -208,6 +268,56 @@ PYBIND11_PLUGIN(seqdb_backend)
             .def("remove_hi_names", &Seqdb::remove_hi_names, py::doc("removes all hi_names (\"h\") found in seqdb (e.g. before matching again)."))
             ;
 
+    py::class_<SeqdbIngest>(m, "SeqdbIngest")
+            .def("__init__", [](SeqdbIngest& aInstance, const std::vector<std::vector<std::string>>& aFiles, size_t aThreads) {
+                    std::vector<SeqdbIngest::File> files;
+                    for (const auto& file: aFiles) {
+                        if (file.size() != 3)
+                            throw std::invalid_argument("SeqdbIngest: [filename, lab, virus_type] expected for each file");
+                        files.push_back({file[0], file[1], file[2]});
+                    }
+                    new (&aInstance) SeqdbIngest(files, aThreads);
+                }, py::arg("files"), py::arg("threads") = size_t(0), py::doc("starts reading and aligning files (list of [filename, lab, virus_type]) in worker threads, threads=0: number of cores."))
+            .def("number_of_files", &SeqdbIngest::number_of_files)
+            .def("number_of_threads", &SeqdbIngest::number_of_threads)
+            .def("next", [](SeqdbIngest& aIngest) { py::gil_scoped_release release; return aIngest.next(); }, py::doc("returns records of the next file in the order of files (see read_fasta_with_name_parsing), waits for it if necessary."))
+            .def("add_sequences", &SeqdbIngest::add_sequences, py::arg("seqdb"), py::arg("records"), py::arg("check_names") = true, py::doc("adds records returned by the last next() (may be normalized, must be in the same order) to seqdb using sequences aligned in advance, returns messages."))
+            ;
+
+    py::class_<PassageMatcher>(m, "PassageMatcher")
+            .def(py::init<>())
+            .def_readonly_static("ReassortantMismatch", &PassageMatcher::ReassortantMismatch)
+            .def("level", &PassageMatcher::level, py::arg("seq_passage"), py::arg("seq_reassortant"), py::arg("hi_passage"), py::arg("hi_reassortant"), py::doc("match level of the seq passage (seq_reassortant is a list) and hi variant passage, lower is better."))
+            .def("match", &PassageMatcher::match, py::arg("seq_passages"), py::arg("seq_reassortants"), py::arg("hi_passages"), py::arg("hi_reassortants"),
+                 py::doc("matches seq groups (list of passage lists and list of reassortant lists) with hi variants (passage and reassortant lists),\nreturns list of (seq_group_no, passage_no, hi_variant_no, level), level is ReassortantMismatch if seq group does not match."))
+            ;
+
+    py::class_<SequenceSketchIndex>(m, "SequenceSketchIndex")
+            .def(py::init<const Seqdb&, bool>(), py::arg("seqdb"), py::arg("amino_acids") = false, py::keep_alive<1, 2>(), py::doc("MinHash sketches of aligned sequences in seqdb for finding closest sequences, seqdb must not be modified while index is used."))
+            .def("nearest", &SequenceSketchIndex::nearest, py::arg("sequence"), py::arg("number") = 10, py::doc("returns list of (entry_seq, estimated identity) for the closest sequences, closest first."))
+            .def("number_of_sequences", &SequenceSketchIndex::number_of_sequences)
+            .def("number_of_sketches", &SequenceSketchIndex::number_of_sketches)
+            ;
+
+    m.def("fasta_encode_name", &fasta_encode_name, py::arg("name"));
+    m.def("read_fasta_with_name_parsing", &read_fasta_with_name_parsing, py::arg("filename"), py::arg("lab") = std::string(), py::arg("virus_type") = std::string(), py::doc("reads (xz or bz2 compressed) fasta file, returns list of dicts {\"name\":, \"sequence\":, \"date\":, \"passage\":, \"lab\":, \"lab_id\":, \"virus_type\":, \"lineage\":, \"gene\":}, empty fields are omitted."));
+    m.def("parse_fasta_name", &parse_fasta_name, py::arg("raw_name"), py::arg("lab") = std::string());
+    m.def("hamming_distance", static_cast<size_t (*)(const std::string&, const std::string&)>(&hamming_distance), py::arg("s1"), py::arg("s2"), py::doc("number of differing positions, sequences are compared up to the shorter length."));
+    m.def("hamming_distances", &hamming_distances, py::arg("base"), py::arg("sequences"), py::doc("hamming distances of each sequence to base."));
+    m.def("hamming_distance_matrix", [](const std::vector<std::string>& aSequences, size_t aThreads) {
+            const auto distances = [&]() { py::gil_scoped_release release; return hamming_distance_matrix(aSequences, aThreads); }();
+            std::vector<std::vector<size_t>> result;
+            for (auto row = distances.begin(); row != distances.end(); row += static_cast<std::vector<size_t>::difference_type>(aSequences.size()))
+                result.emplace_back(row, row + static_cast<std::vector<size_t>::difference_type>(aSequences.size()));
+            return result;
+        }, py::arg("sequences"), py::arg("threads") = size_t(1), py::doc("all pairs hamming distances, list of rows, threads=0: number of cores."));
+
+    m.def("cluster_sequences", &cluster_sequences, py::arg("sequences"), py::arg("max_mismatches"), py::doc("greedy clustering of aligned sequences given in the order of preference, returns index of the cluster representative for each sequence."));
+
+    m.def("align_statistics_enable", &align_statistics_enable, py::arg("enable") = true, py::doc("starts/stops collecting motif hits, frame offsets and latencies of alignment."));
+    m.def("align_statistics_reset", &align_statistics_reset);
+    m.def("align_statistics_json", &align_statistics_json, py::doc("returns collected alignment statistics as json."));
+
       // ----------------------------------------------------------------------
 
     py::class_<Node>(m, "Node")
@@ -233,9 +343,18 @@ PYBIND11_PLUGIN(seqdb_backend)
             .def("make_hz_line_sections", &Tree::make_hz_line_sections, py::arg("tolerance"))
             .def("match_seqdb", &Tree::match_seqdb, py::arg("seqdb"))
             .def("clade_setup", &Tree::clade_setup)
-            .def("make_aa_transitions", static_cast<void (Tree::*)()>(&Tree::make_aa_transitions))
-            .def("make_aa_transitions", static_cast<void (Tree::*)(const std::vector<size_t>&)>(&Tree::make_aa_transitions), py::arg("positions"), py::doc("positions must be in the ascending order, positions are 0-based."))
+            .def("make_aa_transitions", static_cast<void (Tree::*)(size_t)>(&Tree::make_aa_transitions), py::arg("threads") = size_t(0), py::doc("threads=0: number of cores."))
+            .def("make_aa_transitions", static_cast<void (Tree::*)(const std::vector<size_t>&, size_t)>(&Tree::make_aa_transitions), py::arg("positions"), py::arg("threads") = size_t(0), py::doc("positions must be unique and in the ascending order (ValueError otherwise), positions are 0-based, threads=0: number of cores."))
             .def("aa_per_pos", &Tree::aa_per_pos)
+            .def("aa_transitions", [](const Tree& aTree) {
+                    std::vector<std::tuple<std::string, std::string, std::string>> result;
+                    auto add = [&result](const Node& aNode) {
+                        for (const auto& label: aNode.aa_transitions.make_labels(true))
+                            result.emplace_back(aNode.branch_id, label.first, label.second ? label.second->name : std::string());
+                    };
+                    iterate_leaf_pre(aTree, add, add);
+                    return result;
+                }, py::doc("list of (branch_id, label, name of the leaf used for the left part or empty) for aa transitions of all nodes in the pre-order."))
             .def("find_name", &Tree::find_name, py::arg("name"), py::return_value_policy::reference, py::doc("Leaks memory, use for debugging only!"))
             .def("re_root", static_cast<void (Tree::*)(std::string)>(&Tree::re_root), py::arg("name"))
             .def("virus_type", &Tree::virus_type)
@@ -338,6 +457,12 @@ PYBIND11_PLUGIN(seqdb_backend)
             .def_readwrite("show_empty_left", &SettingsAATransition::show_empty_left)
             .def_readwrite("number_strains_threshold", &SettingsAATransition::number_strains_threshold)
             .def_readwrite("show", &SettingsAATransition::show)
+            .def_readonly("per_branch", &SettingsAATransition::per_branch, py::doc("labels per branch, filled by Tree.make_aa_transitions()"))
+            ;
+
+    py::class_<SettingsAATransition::TransitionData>(m, "SettingsAATransitionData")
+            .def_readonly("branch_id", &SettingsAATransition::TransitionData::branch_id)
+            .def_readonly("labels", &SettingsAATransition::TransitionData::labels)
             ;
 
     py::class_<SettingsSignaturePage>(m, "SettingsSignaturePage")
@@ -0,0 +1,69 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+
+#include "fasta-read.hh"
+#include "seqdb.hh"
+
+// ----------------------------------------------------------------------
+
+// Time of adding an update batch (fasta files, e.g. gisaid download) to
+// seqdb via Seqdb::add_sequences. The batch is added twice: the first
+// pass is a normal update (new sequences are translated and aligned),
+// in the second pass every sequence is already in the database and time
+// is spent mostly on matching it against the sequences of its entry
+// (SeqdbEntry::add_or_update_sequence). Use - instead of seqdb to start
+// with the empty database.
+//   dist/seqdb-update-benchmark <seqdb.json.xz|-> <lab> <virus-type> <fasta> ...
+
+static void report_entries(const char* aPrefix, Seqdb& aSeqdb)
+{
+    size_t sequences = 0, max_sequences = 0;
+    for (auto entry = aSeqdb.begin_entry(); entry != aSeqdb.end_entry(); ++entry) {
+        const size_t entry_sequences = static_cast<size_t>(entry->end_seq() - entry->begin_seq());
+        sequences += entry_sequences;
+        max_sequences = std::max(max_sequences, entry_sequences);
+    }
+    std::cout << aPrefix << aSeqdb.number_of_entries() << " entries, " << sequences << " sequences, max " << max_sequences << " sequences per entry" << std::endl;
+
+} // report_entries
+
+// ----------------------------------------------------------------------
+
+int main(int argc, const char *argv[])
+{
+    int exit_code = 0;
+    try {
+        if (argc < 5)
+            throw std::runtime_error(std::string("Usage: ") + argv[0] + " <seqdb.json.xz|-> <lab> <virus-type> <fasta> ...");
+        Seqdb seqdb;
+        if (std::string(argv[1]) != "-")
+            seqdb.load(argv[1]);
+        report_entries("seqdb:       ", seqdb);
+        std::vector<FastaRecord> records;
+        for (int arg = 4; arg < argc; ++arg) {
+            const auto file_records = read_fasta_with_name_parsing(argv[arg], argv[2], argv[3]);
+            records.insert(records.end(), file_records.begin(), file_records.end());
+        }
+        std::cout << "batch:       " << records.size() << " records" << std::endl;
+        const double per_record = records.empty() ? 0.0 : 1.0 / static_cast<double>(records.size());
+        for (const char* pass: {"update:      ", "matching:    "}) {
+            const auto start = std::chrono::steady_clock::now();
+            seqdb.add_sequences(records, true);
+            const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            std::cout << pass << std::fixed << std::setprecision(1) << elapsed.count() << " ms (" << elapsed.count() * 1000.0 * per_record << " us per record)" << std::endl;
+        }
+        report_entries("updated:     ", seqdb);
+    }
+    catch (std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        exit_code = 1;
+    }
+    return exit_code;
+}
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
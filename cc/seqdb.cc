@@ -1,27 +1,31 @@
 #include <typeinfo>
+#include <tuple>
 
 #include "seqdb.hh"
 #include "clades.hh"
+#include "align-references.hh"
 #include "string.hh"
 #include "acmacs-base/read-file.hh"
 
 // ----------------------------------------------------------------------
 
-bool SeqdbSeq::match_update_nucleotides(std::string aNucleotides)
+bool SeqdbSeq::match_update_nucleotides(const SequenceMatcher& aMatcher)
 {
     bool matches = false;
-    if (mNucleotides == aNucleotides) {
+    const auto& nucleotides = aMatcher.sequence();
+    if (aMatcher.equal(mNucleotides, nucleotides_hash())) {
         matches = true;
     }
-    else if (mNucleotides.find(aNucleotides) != std::string::npos) { // sub
+    else if (mNucleotides.size() > nucleotides.size() && aMatcher.is_substring_of(mNucleotides)) { // sub
         matches = true;
     }
-    else if (aNucleotides.find(mNucleotides) != std::string::npos) { // super
+    else if (mNucleotides.size() < nucleotides.size() && aMatcher.contains(mNucleotides)) { // super
         matches = true;
-        mNucleotides = aNucleotides;
+        mNucleotides = nucleotides;
         mNucleotidesShift.reset();
         mAminoAcidsShift.reset();
         mAminoAcids.clear();
+        update_cache();
     }
     return matches;
 
@@ -29,21 +33,23 @@ bool SeqdbSeq::match_update_nucleotides(std::string aNucleotides)
 
 // ----------------------------------------------------------------------
 
-bool SeqdbSeq::match_update_amino_acids(std::string aAminoAcids)
+bool SeqdbSeq::match_update_amino_acids(const SequenceMatcher& aMatcher)
 {
     bool matches = false;
-    if (mAminoAcids == aAminoAcids) {
+    const auto& amino_acids = aMatcher.sequence();
+    if (aMatcher.equal(mAminoAcids, amino_acids_hash())) {
         matches = true;
     }
-    else if (mAminoAcids.find(aAminoAcids) != std::string::npos) { // sub
+    else if (mAminoAcids.size() > amino_acids.size() && aMatcher.is_substring_of(mAminoAcids)) { // sub
         matches = true;
     }
-    else if (aAminoAcids.find(mAminoAcids) != std::string::npos) { // super
+    else if (mAminoAcids.size() < amino_acids.size() && aMatcher.contains(mAminoAcids)) { // super
         matches = true;
         mNucleotides.clear();
         mNucleotidesShift.reset();
         mAminoAcidsShift.reset();
-        mAminoAcids = aAminoAcids;
+        mAminoAcids = amino_acids;
+        update_cache();
     }
     return matches;
 
@@ -100,6 +106,26 @@ void SeqdbSeq::add_lab_id(std::string aLab, std::string aLabId)
 // ----------------------------------------------------------------------
 
 AlignAminoAcidsData SeqdbSeq::align(bool aForce, Messages& aMessages)
+{
+    return align(aForce, aMessages, static_cast<AlignData (*)(std::string::const_iterator, std::string::const_iterator, Messages&)>(&::align));
+
+} // SeqdbSeq::align
+
+// ----------------------------------------------------------------------
+
+AlignAminoAcidsData SeqdbSeq::align_with_references(const ReferenceAligner& aAligner, Messages& aMessages)
+{
+    AlignAminoAcidsData align_data;
+    if (!aligned()) {
+        align_data = align(true, aMessages, [&aAligner](std::string::const_iterator aBegin, std::string::const_iterator aEnd, Messages& aMsg) { return aAligner.align(aBegin, aEnd, aMsg); });
+    }
+    return align_data;
+
+} // SeqdbSeq::align_with_references
+
+// ----------------------------------------------------------------------
+
+AlignAminoAcidsData SeqdbSeq::align(bool aForce, Messages& aMessages, const Aligner& aAligner)
 {
     AlignAminoAcidsData align_data;
 
@@ -115,7 +141,7 @@ AlignAminoAcidsData SeqdbSeq::align(bool aForce, Messages& aMessages)
           break;
       case align_nucleotides:
           mAminoAcidsShift.reset();
-          align_data = translate_and_align(mNucleotides, aMessages);
+          align_data = translate_and_align(mNucleotides, aMessages, aAligner);
           if (!align_data.amino_acids.empty())
               mAminoAcids = align_data.amino_acids;
           if (!align_data.shift.alignment_failed()) {
@@ -131,7 +157,7 @@ AlignAminoAcidsData SeqdbSeq::align(bool aForce, Messages& aMessages)
           break;
       case aling_amino_acids:
           mAminoAcidsShift.reset();
-          align_data = align_amino_acids(mAminoAcids, aMessages);
+          align_data = AlignAminoAcidsData(aAligner(mAminoAcids.cbegin(), mAminoAcids.cend(), aMessages));
           if (align_data.shift.aligned()) {
               mAminoAcidsShift = align_data.shift;
               update_gene(align_data.gene, aMessages, true);
@@ -141,6 +167,8 @@ AlignAminoAcidsData SeqdbSeq::align(bool aForce, Messages& aMessages)
           }
           break;
     }
+    if (what_align != no_align)
+        update_cache();
 
     return align_data;
 
@@ -168,47 +196,104 @@ void SeqdbSeq::update_clades(std::string aVirusType, std::string aLineage)
 
 std::string SeqdbSeq::amino_acids(bool aAligned, size_t aLeftPartSize) const
 {
-    std::string r = mAminoAcids;
-    if (aAligned) {
-        if (!aligned())
-            throw SequenceNotAligned("amino_acids()");
-        r = shift(r, mAminoAcidsShift + static_cast<int>(aLeftPartSize), 'X');
-
-          // find the longest part not having *, replace parts before longest with X, truncate traling parts
-        size_t longest_part_start = 0;
-        size_t longest_part_len = 0;
-        for (size_t start = 0; start != std::string::npos; ) {
-            const size_t found = r.find_first_of('*', start);
-            const size_t len = (found == std::string::npos ? r.size() : found) - start;
-            if (longest_part_len < len) {
-                longest_part_len = len;
-                longest_part_start = start;
-            }
-            start = found == std::string::npos ? found : found + 1;
+    if (!aAligned)
+        return mAminoAcids;
+    else if (aLeftPartSize == 0)
+        return amino_acids_aligned();
+    else
+        return make_amino_acids_aligned(aLeftPartSize);
+
+} // SeqdbSeq::amino_acids
+
+// ----------------------------------------------------------------------
+
+const std::string& SeqdbSeq::amino_acids_aligned() const
+{
+    if (!aligned())
+        throw SequenceNotAligned("amino_acids()");
+    return mAminoAcidsAligned;
+
+} // SeqdbSeq::amino_acids_aligned
+
+// ----------------------------------------------------------------------
+
+std::string SeqdbSeq::make_amino_acids_aligned(size_t aLeftPartSize) const
+{
+    if (!aligned())
+        throw SequenceNotAligned("amino_acids()");
+    std::string r = shift(mAminoAcids, mAminoAcidsShift + static_cast<int>(aLeftPartSize), 'X');
+
+      // find the longest part not having *, replace parts before longest with X, truncate traling parts
+    size_t longest_part_start = 0;
+    size_t longest_part_len = 0;
+    for (size_t start = 0; start != std::string::npos; ) {
+        const size_t found = r.find_first_of('*', start);
+        const size_t len = (found == std::string::npos ? r.size() : found) - start;
+        if (longest_part_len < len) {
+            longest_part_len = len;
+            longest_part_start = start;
         }
-        r.replace(0, longest_part_start, longest_part_start, 'X');
-        r.resize(longest_part_start + longest_part_len, 'X');
+        start = found == std::string::npos ? found : found + 1;
     }
+    r.replace(0, longest_part_start, longest_part_start, 'X');
+    r.resize(longest_part_start + longest_part_len, 'X');
     return r;
 
-} // SeqdbSeq::amino_acids
+} // SeqdbSeq::make_amino_acids_aligned
 
 // ----------------------------------------------------------------------
 
-std::string SeqdbSeq::nucleotides(bool aAligned, size_t aLeftPartSize) const
+void SeqdbSeq::update_cache()
 {
-    std::string r = mNucleotides;
-    if (aAligned) {
-        if (!aligned())
-            throw SequenceNotAligned("nucleotides()");
-        r = shift(r, mNucleotidesShift + static_cast<int>(aLeftPartSize), '-');
+    mNucleotidesHash = SequenceMatcher::hash(mNucleotides);
+    mAminoAcidsHash = SequenceMatcher::hash(mAminoAcids);
+    mAminoAcidsAligned.clear();
+    mNucleotidesAligned.clear();
+    if (aligned()) {
+        mAminoAcidsAligned = make_amino_acids_aligned(0);
+        if (mNucleotidesShift.aligned())
+            mNucleotidesAligned = make_nucleotides_aligned(0);
     }
-    return r;
+
+} // SeqdbSeq::update_cache
+
+// ----------------------------------------------------------------------
+
+std::string SeqdbSeq::nucleotides(bool aAligned, size_t aLeftPartSize) const
+{
+    if (!aAligned)
+        return mNucleotides;
+    else if (aLeftPartSize == 0)
+        return nucleotides_aligned();
+    else
+        return make_nucleotides_aligned(aLeftPartSize);
 
 } // SeqdbSeq::nucleotides
 
 // ----------------------------------------------------------------------
 
+const std::string& SeqdbSeq::nucleotides_aligned() const
+{
+    if (!aligned())
+        throw SequenceNotAligned("nucleotides()");
+    if (!mNucleotidesShift.aligned()) // amino acids only
+        throw InvalidShift();
+    return mNucleotidesAligned;
+
+} // SeqdbSeq::nucleotides_aligned
+
+// ----------------------------------------------------------------------
+
+std::string SeqdbSeq::make_nucleotides_aligned(size_t aLeftPartSize) const
+{
+    if (!aligned())
+        throw SequenceNotAligned("nucleotides()");
+    return shift(mNucleotides, mNucleotidesShift + static_cast<int>(aLeftPartSize), '-');
+
+} // SeqdbSeq::make_nucleotides_aligned
+
+// ----------------------------------------------------------------------
+
 void SeqdbEntry::add_date(std::string aDate)
 {
     auto insertion_pos = std::lower_bound(mDates.begin(), mDates.end(), aDate);
@@ -246,44 +331,77 @@ void SeqdbEntry::update_subtype(std::string aSubtype, Messages& aMessages)
 
 // ----------------------------------------------------------------------
 
-std::string SeqdbEntry::add_or_update_sequence(std::string aSequence, std::string aPassage, std::string aReassortant, std::string aLab, std::string aLabId, std::string aGene)
+std::string SeqdbEntry::add_or_update(std::string aSequence, std::string aPassage, std::string aReassortant, std::string aLab, std::string aLabId, std::string aGene, SeqdbSeqPrepared* aPrepared)
 {
     Messages messages;
     const bool nucs = is_nucleotides(aSequence);
+    const SequenceMatcher matcher(aSequence);
     decltype(mSeq.begin()) found;
     if (nucs)
-        found = std::find_if(mSeq.begin(), mSeq.end(), [&aSequence](SeqdbSeq& seq) { return seq.match_update_nucleotides(aSequence); });
+        found = std::find_if(mSeq.begin(), mSeq.end(), [&matcher](SeqdbSeq& seq) { return seq.match_update_nucleotides(matcher); });
     else
-        found = std::find_if(mSeq.begin(), mSeq.end(), [&aSequence](SeqdbSeq& seq) { return seq.match_update_amino_acids(aSequence); });
+        found = std::find_if(mSeq.begin(), mSeq.end(), [&matcher](SeqdbSeq& seq) { return seq.match_update_amino_acids(matcher); });
+    bool prepared = false;
     if (found != mSeq.end()) {  // update
         found->update_gene(aGene, messages);
     }
     else { // add
-        if (nucs)
+        if (aPrepared) {
+            mSeq.push_back(std::move(aPrepared->seq));
+            prepared = true;
+        }
+        else if (nucs) {
             mSeq.push_back(SeqdbSeq(aSequence, aGene));
-        else
+        }
+        else {
             mSeq.push_back(SeqdbSeq(std::string(), aSequence, aGene));
+        }
         found = mSeq.end() - 1;
     }
     if (found != mSeq.end()) {
         found->add_passage(aPassage);
         found->add_reassortant(aReassortant);
         found->add_lab_id(aLab, aLabId);
-        auto align_data = found->align(false, messages);
+        AlignAminoAcidsData align_data;
+        if (prepared) {
+            align_data = aPrepared->align_data;
+            if (!aPrepared->messages.empty())
+                messages.warning() << aPrepared->messages << std::endl;
+        }
+        else {
+            align_data = found->align(false, messages);
+        }
         update_subtype(align_data.subtype, messages);
         update_lineage(align_data.lineage, messages);
     }
     return messages;
 
-} // SeqdbEntry::add_or_update_sequence
+} // SeqdbEntry::add_or_update
+
+// ----------------------------------------------------------------------
+
+SeqdbSeqPrepared prepare_sequence(std::string aSequence, std::string aGene)
+{
+    SeqdbSeqPrepared prepared{aSequence, aGene, is_nucleotides(aSequence) ? SeqdbSeq(aSequence, aGene) : SeqdbSeq(std::string(), aSequence, aGene), AlignAminoAcidsData(), std::string()};
+    Messages messages;
+    prepared.align_data = prepared.seq.align(false, messages);
+    prepared.messages = messages;
+    return prepared;
+
+} // prepare_sequence
 
 // ----------------------------------------------------------------------
 
 SeqdbEntry* Seqdb::new_entry(std::string aName)
 {
     auto const first = find_insertion_place(aName);
-    if (first != mEntries.end() && aName == first->name())
+    if ((first != mEntries.end() && aName == first->name()) || find_in_bulk(aName) != nullptr)
         throw std::runtime_error(std::string("Entry for \"") + aName + "\" already exists");
+    if (mBulkInsert) {
+        mBulkEntries.emplace_back(aName);
+        mBulkIndex.emplace(aName, &mBulkEntries.back());
+        return &mBulkEntries.back();
+    }
     auto inserted = mEntries.insert(first, SeqdbEntry(aName));
     return &*inserted;
 
@@ -291,6 +409,87 @@ SeqdbEntry* Seqdb::new_entry(std::string aName)
 
 // ----------------------------------------------------------------------
 
+void Seqdb::begin_bulk_insert()
+{
+    mBulkInsert = true;
+
+} // Seqdb::begin_bulk_insert
+
+// ----------------------------------------------------------------------
+
+void Seqdb::commit_bulk_insert()
+{
+    if (!mBulkEntries.empty()) {
+        const auto committed = static_cast<decltype(mEntries)::difference_type>(mEntries.size());
+        mEntries.reserve(mEntries.size() + mBulkEntries.size());
+        std::move(mBulkEntries.begin(), mBulkEntries.end(), std::back_inserter(mEntries));
+        auto by_name = [](const SeqdbEntry& a, const SeqdbEntry& b) -> bool { return a.mName < b.mName; };
+        std::sort(mEntries.begin() + committed, mEntries.end(), by_name);
+        std::inplace_merge(mEntries.begin(), mEntries.begin() + committed, mEntries.end(), by_name);
+    }
+    mBulkEntries.clear();
+    mBulkIndex.clear();
+    mBulkInsert = false;
+
+} // Seqdb::commit_bulk_insert
+
+// ----------------------------------------------------------------------
+
+std::string Seqdb::add_sequences(const std::vector<std::map<std::string, std::string>>& aRecords, bool aCheckNames, std::vector<SeqdbSeqPrepared>* aPrepared)
+{
+    static const std::regex re_name("^(A\\(H\\d+N\\d+\\)|B)/");
+    if (aPrepared && aPrepared->size() != aRecords.size())
+        throw std::runtime_error("Seqdb::add_sequences: number of prepared sequences (" + std::to_string(aPrepared->size()) + ") does not match number of records (" + std::to_string(aRecords.size()) + ")");
+    Messages messages;
+    begin_bulk_insert();        // new entries are merged into mEntries once at the end
+    try {
+        for (size_t record_no = 0; record_no < aRecords.size(); ++record_no) {
+            const auto& record = aRecords[record_no];
+            auto field = [&record](const char* aKey) -> std::string { const auto found = record.find(aKey); return found == record.end() ? std::string() : found->second; };
+            const auto name = field("name"), virus_type = field("virus_type");
+            if (name.empty()) {
+                messages.warning() << "Cannot add entry without name: " << field("lab_id") << std::endl;
+                continue;
+            }
+            if (name.size() > 1 && (name[1] == '/' || name[1] == '(') && !virus_type.empty() && name[0] != virus_type[0])
+                messages.warning() << "Virus type (" << virus_type << ") and name (" << name << ") mismatch" << std::endl;
+            auto* entry = find_by_name(name);
+            if (entry == nullptr) {
+                if (aCheckNames && !std::regex_search(name, re_name))
+                    messages.warning() << "Suspicious name \"" << name << '"' << std::endl;
+                entry = new_entry(name);
+                entry->virus_type(virus_type);
+            }
+            if (!virus_type.empty() && entry->virus_type() != virus_type)
+                throw std::runtime_error("Cannot add \"" + virus_type + "\" to \"" + entry->virus_type() + "\"");
+            if (!field("country").empty())
+                entry->country(field("country"));
+            if (!field("continent").empty())
+                entry->continent(field("continent"));
+            if (!field("date").empty())
+                entry->add_date(field("date"));
+            std::string message;
+            if (aPrepared && (*aPrepared)[record_no].sequence == field("sequence") && (*aPrepared)[record_no].gene == field("gene"))
+                message = entry->add_prepared_sequence((*aPrepared)[record_no], field("passage"), field("reassortant"), field("lab"), field("lab_id"));
+            else
+                message = entry->add_or_update_sequence(field("sequence"), field("passage"), field("reassortant"), field("lab"), field("lab_id"), field("gene"));
+            if (!message.empty()) {
+                std::replace(message.begin(), message.end(), '\n', ' ');
+                messages.warning() << name << ": " << message << std::endl;
+            }
+        }
+    }
+    catch (...) {
+        commit_bulk_insert();
+        throw;
+    }
+    commit_bulk_insert();
+    return messages;
+
+} // Seqdb::add_sequences
+
+// ----------------------------------------------------------------------
+
 std::string Seqdb::cleanup(bool remove_short_sequences)
 {
     Messages messages;
@@ -315,6 +514,51 @@ std::string Seqdb::cleanup(bool remove_short_sequences)
 
 // ----------------------------------------------------------------------
 
+std::string Seqdb::align_with_references()
+{
+    Messages messages;
+
+    std::map<std::tuple<std::string, std::string, std::string>, const SeqdbSeq*> longest; // (subtype, lineage, gene) -> seq
+    for (const auto& entry: mEntries) {
+        for (const auto& seq: entry.mSeq) {
+            if (seq.aligned()) {
+                auto& ref = longest[std::make_tuple(entry.mVirusType, entry.mLineage, seq.mGene)];
+                if (ref == nullptr || ref->mAminoAcids.size() < seq.mAminoAcids.size())
+                    ref = &seq;
+            }
+        }
+    }
+    ReferenceAligner aligner;
+    for (const auto& ref: longest)
+        aligner.add_reference(std::get<0>(ref.first), std::get<1>(ref.first), std::get<2>(ref.first), ref.second->mAminoAcids, ref.second->mAminoAcidsShift);
+
+    size_t aligned = 0, not_aligned = 0;
+    for (auto& entry: mEntries) {
+        for (auto& seq: entry.mSeq) {
+            if (!seq.aligned() && seq.translated()) {
+                Messages seq_messages;
+                const auto align_data = seq.align_with_references(aligner, seq_messages);
+                if (seq.aligned()) {
+                    entry.update_subtype(align_data.subtype, seq_messages);
+                    entry.update_lineage(align_data.lineage, seq_messages);
+                    const std::string seq_warnings = seq_messages;
+                    if (!seq_warnings.empty())
+                        messages.warning() << entry.name() << ": " << seq_warnings << std::endl;
+                    ++aligned;
+                }
+                else {
+                    ++not_aligned;
+                }
+            }
+        }
+    }
+    messages.warning() << "Aligned using " << aligner.number_of_references() << " references: " << aligned << ", still not aligned: " << not_aligned << std::endl;
+    return messages;
+
+} // Seqdb::align_with_references
+
+// ----------------------------------------------------------------------
+
 std::string Seqdb::report() const
 {
     std::ostringstream os;
@@ -352,6 +596,7 @@ std::string Seqdb::report() const
 
 std::string Seqdb::report_identical() const
 {
+    static const std::string sNotAligned;
     std::ostringstream os;
 
     auto report = [&os](std::string prefix, const auto& groups) {
@@ -367,7 +612,7 @@ std::string Seqdb::report_identical() const
     };
 
     try {
-        report("Identical nucleotides:", find_identical_sequences([](const SeqdbEntrySeq& e) -> std::string { try { return e.seq().nucleotides(true); } catch (SequenceNotAligned&) { return std::string(); } }));
+        report("Identical nucleotides:", find_identical_sequences([](const SeqdbEntrySeq& e) -> const std::string& { return e.seq().aligned() ? e.seq().nucleotides_aligned() : sNotAligned; }));
         os << std::endl;
     }
     catch (std::exception& err) {
@@ -375,7 +620,7 @@ std::string Seqdb::report_identical() const
     }
 
     try {
-        report("Identical amino-acids:", find_identical_sequences([](const SeqdbEntrySeq& e) -> std::string { try { return e.seq().amino_acids(true); } catch (SequenceNotAligned&) { return std::string(); } }));
+        report("Identical amino-acids:", find_identical_sequences([](const SeqdbEntrySeq& e) -> const std::string& { return e.seq().aligned() ? e.seq().amino_acids_aligned() : sNotAligned; }));
         os << std::endl;
     }
     catch (std::exception& err) {
@@ -489,6 +734,8 @@ void Seqdb::from_json(std::string data)
 {
     try {
         json::parse(data, *this);
+        for (auto& entry: mEntries)
+            std::for_each(entry.mSeq.begin(), entry.mSeq.end(), std::mem_fn(&SeqdbSeq::update_cache));
     }
     catch (json::parsing_error& err) {
         std::cerr << "tree parsing error: "<< err.what() << std::endl;
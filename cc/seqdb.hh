@@ -7,11 +7,17 @@
 #include <regex>
 #include <iterator>
 #include <deque>
+#include <map>
+#include <unordered_map>
+#include <type_traits>
+#include <thread>
+#include <exception>
 
 #include "messages.hh"
 #include "json-struct.hh"
 #include "sequence-shift.hh"
 #include "amino-acids.hh"
+#include "sequence-match.hh"
 
 // ----------------------------------------------------------------------
 
@@ -42,6 +48,7 @@
 
 class Seqdb;
 class SeqdbIterator;
+class ReferenceAligner;
 
 // ----------------------------------------------------------------------
 
@@ -65,6 +72,7 @@ class SeqdbSeq
             mAminoAcids = aAminoAcids;
             if (!aGene.empty())
                 mGene = aGene;
+            update_cache();
         }
 
     inline SeqdbSeq(std::string aNucleotides, std::string aGene)
@@ -73,10 +81,13 @@ class SeqdbSeq
         }
 
     AlignAminoAcidsData align(bool aForce, Messages& aMessages);
+      // aligns sequence that was not aligned by motifs using reference sequences
+    AlignAminoAcidsData align_with_references(const ReferenceAligner& aAligner, Messages& aMessages);
 
       // returns if aNucleotides matches mNucleotides
-    bool match_update_nucleotides(std::string aNucleotides);
-    bool match_update_amino_acids(std::string aAminoAcids);
+      // sequence of aMatcher is equal to, sub or super (then it replaces) sequence of this
+    bool match_update_nucleotides(const SequenceMatcher& aMatcher);
+    bool match_update_amino_acids(const SequenceMatcher& aMatcher);
     void add_passage(std::string aPassage);
     void update_gene(std::string aGene, Messages& aMessages, bool replace_ha = false);
     void add_reassortant(std::string aReassortant);
@@ -110,6 +121,9 @@ class SeqdbSeq
       // if aAligned && aLeftPartSize > 0 - include signal peptide and other stuff to the left from the beginning of the aligned sequence
     std::string amino_acids(bool aAligned, size_t aLeftPartSize = 0) const;
     std::string nucleotides(bool aAligned, size_t aLeftPartSize = 0) const;
+      // amino_acids(true) and nucleotides(true) computed upon changing sequence or shift, throw if sequence was not aligned
+    const std::string& amino_acids_aligned() const;
+    const std::string& nucleotides_aligned() const;
     inline int amino_acids_shift() const { return mAminoAcidsShift; } // throws if sequence was not aligned
     inline int nucleotides_shift() const { return mNucleotidesShift; }  // throws if sequence was not aligned
 
@@ -130,14 +144,32 @@ class SeqdbSeq
     std::vector<std::string> mHiNames;
     std::vector<std::string> mReassortant;
     std::vector<std::string> mClades;
-
-    static inline std::string shift(std::string aSource, int aShift, char aFill)
+      // Derived from the sequences and shifts by update_cache() which must be called upon changing them, const methods
+      // only read the cache and therefore can be called from multiple threads. Aligned sequences are empty if not aligned.
+    std::string mAminoAcidsAligned;
+    std::string mNucleotidesAligned;
+    size_t mNucleotidesHash = 0;
+    size_t mAminoAcidsHash = 0;
+
+    void update_cache();
+    inline size_t nucleotides_hash() const { return mNucleotidesHash; }
+    inline size_t amino_acids_hash() const { return mAminoAcidsHash; }
+    std::string make_amino_acids_aligned(size_t aLeftPartSize) const;
+    std::string make_nucleotides_aligned(size_t aLeftPartSize) const;
+
+    AlignAminoAcidsData align(bool aForce, Messages& aMessages, const Aligner& aAligner);
+
+    static inline std::string shift(const std::string& aSource, int aShift, char aFill)
         {
-            std::string r = aSource;
-            if (aShift < 0)
-                r.erase(0, static_cast<size_t>(-aShift));
-            else if (aShift > 0)
-                r.insert(0, static_cast<size_t>(aShift), aFill);
+            std::string r;
+            if (aShift < 0) {
+                r.assign(aSource, std::min(aSource.size(), static_cast<size_t>(-aShift)), std::string::npos);
+            }
+            else {
+                r.reserve(aSource.size() + static_cast<size_t>(aShift));
+                r.assign(static_cast<size_t>(aShift), aFill);
+                r.append(aSource);
+            }
             return r;
         }
 
@@ -163,6 +195,21 @@ class SeqdbSeq
 
 }; // class SeqdbSeq
 
+// ----------------------------------------------------------------------
+
+  // new sequence translated and aligned in advance (e.g. in a worker thread of SeqdbIngest), see SeqdbEntry::add_prepared_sequence
+struct SeqdbSeqPrepared
+{
+    std::string sequence;
+    std::string gene;
+    SeqdbSeq seq;
+    AlignAminoAcidsData align_data;
+    std::string messages;
+};
+
+  // does not access seqdb, can be called concurrently
+SeqdbSeqPrepared prepare_sequence(std::string aSequence, std::string aGene);
+
 // ----------------------------------------------------------------------
 
 inline std::ostream& operator<<(std::ostream& out, const SeqdbSeq& seq)
@@ -193,7 +240,15 @@ class SeqdbEntry
     void update_lineage(std::string aLineage, Messages& aMessages);
     void update_subtype(std::string aSubtype, Messages& aMessages);
       // returns warning message or an empty string
-    std::string add_or_update_sequence(std::string aSequence, std::string aPassage, std::string aReassortant, std::string aLab, std::string aLabId, std::string aGene);
+    inline std::string add_or_update_sequence(std::string aSequence, std::string aPassage, std::string aReassortant, std::string aLab, std::string aLabId, std::string aGene)
+        {
+            return add_or_update(aSequence, aPassage, aReassortant, aLab, aLabId, aGene, nullptr);
+        }
+      // the same as add_or_update_sequence but, if sequence is new for this entry, aPrepared.seq is moved in instead of translating and aligning again
+    inline std::string add_prepared_sequence(SeqdbSeqPrepared& aPrepared, std::string aPassage, std::string aReassortant, std::string aLab, std::string aLabId)
+        {
+            return add_or_update(aPrepared.sequence, aPassage, aReassortant, aLab, aLabId, aPrepared.gene, &aPrepared);
+        }
 
     inline bool date_within_range(std::string aBegin, std::string aEnd) const
         {
@@ -238,6 +293,8 @@ class SeqdbEntry
     std::string mVirusType;
     std::vector<SeqdbSeq> mSeq;
 
+    std::string add_or_update(std::string aSequence, std::string aPassage, std::string aReassortant, std::string aLab, std::string aLabId, std::string aGene, SeqdbSeqPrepared* aPrepared);
+
     friend class Seqdb;
     friend class SeqdbIteratorBase;
     friend class SeqdbIterator;
@@ -434,21 +491,27 @@ class Seqdb
     inline SeqdbEntry* find_by_name(std::string aName)
         {
             auto const first = find_insertion_place(aName);
-            return (first != mEntries.end() && aName == first->name()) ? &(*first) : nullptr;
+            return (first != mEntries.end() && aName == first->name()) ? &(*first) : find_in_bulk(aName);
         }
 
     inline const SeqdbEntry* find_by_name(std::string aName) const
         {
             auto const first = find_insertion_place(aName);
-            return (first != mEntries.end() && aName == first->name()) ? &(*first) : nullptr;
+            return (first != mEntries.end() && aName == first->name()) ? &(*first) : find_in_bulk(aName);
         }
 
     SeqdbEntrySeq find_by_seq_id(std::string aSeqId) const;
 
     SeqdbEntry* new_entry(std::string aName);
 
+      // bulk counterpart of SeqdbUpdater._add_sequence (python/seqdb/update.py), records are fasta-read.hh FastaRecord like maps
+      // with (optional) name, virus_type, country, continent, date, passage, reassortant, lab, lab_id, gene, sequence. returns messages
+      // aPrepared (if not null) must correspond to aRecords, sequences prepared in advance are used if they are the same as in the records
+    std::string add_sequences(const std::vector<std::map<std::string, std::string>>& aRecords, bool aCheckNames, std::vector<SeqdbSeqPrepared>* aPrepared = nullptr);
       // removes short sequences, removes entries having no sequences. returns messages
     std::string cleanup(bool remove_short_sequences);
+      // aligns sequences not aligned by motifs against the longest aligned sequence of each subtype/lineage/gene, returns messages
+    std::string align_with_references();
 
       // returns db stat
     std::string report() const;
@@ -465,10 +528,14 @@ class Seqdb
     inline auto begin_entry() { return mEntries.begin(); }
     inline auto end_entry() { return mEntries.end(); }
 
-    template <typename Value> std::deque<std::vector<SeqdbEntrySeq>> find_identical_sequences(Value value) const;
+      // value is called from aThreads threads (0 - number of cores), it must not change anything
+    template <typename Value> std::deque<std::vector<SeqdbEntrySeq>> find_identical_sequences(Value value, size_t aThreads = 0) const;
 
  private:
     std::vector<SeqdbEntry> mEntries;
+    bool mBulkInsert = false;
+    std::deque<SeqdbEntry> mBulkEntries;
+    std::unordered_map<std::string, SeqdbEntry*> mBulkIndex;
     const std::regex sReYearSpace = std::regex("/[12][0-9][0-9][0-9] ");
 
     inline std::vector<SeqdbEntry>::iterator find_insertion_place(std::string aName)
@@ -481,6 +548,21 @@ class Seqdb
             return std::lower_bound(mEntries.begin(), mEntries.end(), aName, [](const SeqdbEntry& entry, std::string name) -> bool { return entry.name() < name; });
         }
 
+      // Bulk insert mode is used by add_sequences() only: new_entry() appends entries to a separate storage, pointers to
+      // all entries stay valid, new entries are found by find_by_name() via hash index. commit_bulk_insert() sorts new
+      // entries and merges them into the database, pointers become invalid then. Other methods (iterating, cleanup,
+      // save) see committed entries only, therefore the mode is not exposed outside.
+    void begin_bulk_insert();
+    void commit_bulk_insert();
+
+    inline SeqdbEntry* find_in_bulk(std::string aName) const
+        {
+            if (mBulkIndex.empty())
+                return nullptr;
+            auto const found = mBulkIndex.find(aName);
+            return found == mBulkIndex.end() ? nullptr : found->second;
+        }
+
     friend class SeqdbIteratorBase;
     friend class SeqdbIterator;
     friend class ConstSeqdbIterator;
@@ -607,27 +689,96 @@ inline SeqdbIteratorBase& SeqdbIteratorBase::operator ++ ()
 
 // ----------------------------------------------------------------------
 
-template <typename Value> std::deque<std::vector<SeqdbEntrySeq>> Seqdb::find_identical_sequences(Value value) const
+// Each value is computed once and sequences are grouped by the hash of
+// their value, values within a hash bucket are compared to separate
+// collisions. Values are computed and hashed in threads, each thread
+// processes a contiguous range of sequences and groups them in its own
+// map, the maps are merged in the thread order. Groups are in the order
+// of their first sequence in seqdb, sequences within a group are in
+// seqdb order.
+template <typename Value> std::deque<std::vector<SeqdbEntrySeq>> Seqdb::find_identical_sequences(Value value, size_t aThreads) const
 {
+    typedef decltype(value(std::declval<const SeqdbEntrySeq&>())) ValueResult;
+    typedef std::decay_t<ValueResult> ValueT;
+      // keep just references if value() returns them (e.g. cached aligned sequence)
+    typedef std::conditional_t<std::is_lvalue_reference<ValueResult>::value, std::reference_wrapper<const ValueT>, ValueT> Stored;
+    auto get = [](const Stored& aStored) -> const ValueT& { return aStored; };
+    typedef std::unordered_map<size_t, std::vector<size_t>> Buckets; // hash -> sequence numbers
+
     std::vector<SeqdbEntrySeq> refs(begin(), end());
-    sort(refs.begin(), refs.end(), [&value](const auto& a, const auto b) { return value(a) < value(b); });
-    std::deque<std::vector<SeqdbEntrySeq>> identical = {{}};
-    for (auto previous = refs.begin(), current = previous + 1; current != refs.end(); ++current) {
-        if (value(*previous) == value(*current)) {
-            if (!value(*previous).empty()) { // empty means not aligned, ignore them
-                if (identical.back().empty())
-                    identical.back().push_back(*previous);
-                identical.back().push_back(*current);
+    if (aThreads == 0)
+        aThreads = std::max(1U, std::thread::hardware_concurrency());
+    aThreads = std::max(size_t(1), std::min(aThreads, refs.size()));
+    std::vector<size_t> first_no(aThreads + 1); // sequences refs[first_no[thread_no]..first_no[thread_no + 1]) are processed by thread_no
+    for (size_t thread_no = 0; thread_no <= aThreads; ++thread_no)
+        first_no[thread_no] = refs.size() * thread_no / aThreads;
+    std::vector<std::vector<Stored>> thread_values(aThreads);
+    std::vector<Buckets> thread_buckets(aThreads);
+    std::vector<std::exception_ptr> thread_errors(aThreads);
+    auto hash_values = [&](size_t thread_no) {
+        try {
+            auto& values = thread_values[thread_no];
+            auto& buckets = thread_buckets[thread_no];
+            values.reserve(first_no[thread_no + 1] - first_no[thread_no]);
+            buckets.reserve(values.capacity());
+            for (size_t no = first_no[thread_no]; no < first_no[thread_no + 1]; ++no) {
+                values.push_back(value(refs[no]));
+                const ValueT& val = get(values.back());
+                if (!val.empty())       // empty means not aligned, ignore them
+                    buckets[std::hash<ValueT>()(val)].push_back(no);
             }
         }
-        else {
-            previous = current;
-            if (!identical.back().empty())
-                identical.push_back(std::vector<SeqdbEntrySeq>());
+        catch (...) {
+            thread_errors[thread_no] = std::current_exception();
+        }
+    };
+    if (aThreads == 1) {
+        hash_values(0);
+    }
+    else {
+        std::vector<std::thread> workers;
+        for (size_t thread_no = 0; thread_no < aThreads; ++thread_no)
+            workers.emplace_back(hash_values, thread_no);
+        for (auto& worker: workers)
+            worker.join();
+    }
+    for (const auto& error: thread_errors) {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    std::vector<Stored> values;
+    values.reserve(refs.size());
+    for (auto& thread_value: thread_values)
+        std::move(thread_value.begin(), thread_value.end(), std::back_inserter(values));
+    Buckets buckets = std::move(thread_buckets[0]);
+    for (size_t thread_no = 1; thread_no < aThreads; ++thread_no) {
+        for (auto& bucket: thread_buckets[thread_no]) {
+            auto& merged = buckets[bucket.first];
+            merged.insert(merged.end(), bucket.second.begin(), bucket.second.end());
         }
     }
-    if (identical.back().empty())
-        identical.pop_back();
+
+    std::vector<std::vector<size_t>> groups;
+    for (auto& bucket: buckets) {
+        auto& rest = bucket.second;
+        while (rest.size() > 1) {
+            const ValueT& first = get(values[rest.front()]);
+            const auto split = std::stable_partition(rest.begin(), rest.end(), [&](size_t no) { return get(values[no]) == first; });
+            if ((split - rest.begin()) > 1)
+                groups.emplace_back(rest.begin(), split);
+            rest.erase(rest.begin(), split);
+        }
+    }
+    std::sort(groups.begin(), groups.end(), [](const auto& a, const auto& b) { return a.front() < b.front(); });
+
+    std::deque<std::vector<SeqdbEntrySeq>> identical;
+    for (const auto& group: groups) {
+        identical.emplace_back();
+        identical.back().reserve(group.size());
+        for (auto no: group)
+            identical.back().push_back(refs[no]);
+    }
     return identical;
 
 } // Seqdb::find_identical_sequences
@@ -0,0 +1,77 @@
+#include <array>
+
+#include "sequence-clusters.hh"
+#include "hamming-distance.hh"
+
+// ----------------------------------------------------------------------
+
+// Distance is the hamming distance plus the difference in length, i.e.
+// hamming distance of sequences padded to the same length. It is a
+// metric, so a representative r cannot be within aMaxMismatches of
+// sequence s if |d(s, pivot) - d(r, pivot)| > aMaxMismatches for any
+// pivot. The first representatives serve as pivots, distances of every
+// representative to them are kept, so most representatives are
+// rejected without comparing sequences.
+
+namespace
+{
+    constexpr size_t NumberOfPivots = 8;
+
+    inline size_t distance(const std::string& s1, const std::string& s2, size_t aLimit)
+    {
+        const size_t length_diff = s1.size() > s2.size() ? s1.size() - s2.size() : s2.size() - s1.size();
+        if (length_diff > aLimit)
+            return length_diff;
+        return length_diff + hamming_distance(s1, s2, aLimit - length_diff);
+    }
+
+    struct Representative
+    {
+        size_t no;
+        std::array<size_t, NumberOfPivots> to_pivot;
+    };
+}
+
+// ----------------------------------------------------------------------
+
+std::vector<size_t> cluster_sequences(const std::vector<std::string>& aSequences, size_t aMaxMismatches)
+{
+    constexpr size_t no_limit = std::numeric_limits<size_t>::max();
+    std::vector<size_t> result(aSequences.size());
+    std::vector<Representative> representatives;
+    std::array<size_t, NumberOfPivots> to_pivot;
+    for (size_t seq_no = 0; seq_no < aSequences.size(); ++seq_no) {
+        const auto& seq = aSequences[seq_no];
+        const size_t number_of_pivots = std::min(NumberOfPivots, representatives.size());
+        size_t found = no_limit;
+        for (size_t pivot_no = 0; pivot_no < number_of_pivots; ++pivot_no) {
+            to_pivot[pivot_no] = distance(seq, aSequences[representatives[pivot_no].no], no_limit);
+            if (found == no_limit && to_pivot[pivot_no] <= aMaxMismatches)
+                found = representatives[pivot_no].no;
+        }
+        for (auto rep = representatives.begin() + static_cast<std::vector<Representative>::difference_type>(number_of_pivots); found == no_limit && rep != representatives.end(); ++rep) {
+            bool candidate = true;
+            for (size_t pivot_no = 0; candidate && pivot_no < number_of_pivots; ++pivot_no) {
+                const size_t diff = to_pivot[pivot_no] > rep->to_pivot[pivot_no] ? to_pivot[pivot_no] - rep->to_pivot[pivot_no] : rep->to_pivot[pivot_no] - to_pivot[pivot_no];
+                candidate = diff <= aMaxMismatches;
+            }
+            if (candidate && distance(seq, aSequences[rep->no], aMaxMismatches) <= aMaxMismatches)
+                found = rep->no;
+        }
+        if (found == no_limit) {
+            representatives.push_back({seq_no, to_pivot});
+            if (representatives.size() <= NumberOfPivots) // new pivot, distances of the previous representatives to it are needed
+                for (auto& rep: representatives)
+                    rep.to_pivot[representatives.size() - 1] = distance(aSequences[rep.no], seq, no_limit);
+            found = seq_no;
+        }
+        result[seq_no] = found;
+    }
+    return result;
+
+} // cluster_sequences
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
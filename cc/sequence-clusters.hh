@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// ----------------------------------------------------------------------
+
+// Greedy clustering of near identical aligned sequences, used to
+// subsample tree input. Sequences are expected in the order of
+// preference: each sequence joins the first representative within
+// aMaxMismatches, otherwise it becomes a representative itself.
+// Returns, for each sequence, index of its representative (i.e.
+// representatives are sequences with result[no] == no).
+
+std::vector<size_t> cluster_sequences(const std::vector<std::string>& aSequences, size_t aMaxMismatches);
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <functional>
+#include <cstring>
+#include <cstdint>
+
+// ----------------------------------------------------------------------
+
+// Matching of one (incoming) sequence against many others, see
+// SeqdbEntry::add_or_update_sequence. Equality is checked by hash first.
+// Search of the sequence in a longer one uses Boyer-Moore-Horspool with
+// the skip table made once. Search of a shorter sequence in this one
+// looks up positions of its first k-mer in the index of this sequence.
+// Making the index costs about as much as scanning IndexCost sequence
+// lengths, so shorter sequences are searched by std::string::find until
+// that many positions are scanned, the index is made after that.
+
+class SequenceMatcher
+{
+ public:
+    inline SequenceMatcher(const std::string& aSequence)
+        : mSequence(aSequence), mHash(hash(aSequence))
+        {
+            mSkip.fill(mSequence.size());
+            for (size_t pos = 0; (pos + 1) < mSequence.size(); ++pos)
+                mSkip[static_cast<unsigned char>(mSequence[pos])] = mSequence.size() - 1 - pos;
+        }
+
+    static inline size_t hash(const std::string& aSequence) { return std::hash<std::string>()(aSequence); }
+
+    inline const std::string& sequence() const { return mSequence; }
+
+      // aNotherHash is hash(aNother)
+    inline bool equal(const std::string& aNother, size_t aNotherHash) const { return aNotherHash == mHash && aNother == mSequence; }
+
+      // the same as aHaystack.find(sequence()) != std::string::npos
+    inline bool is_substring_of(const std::string& aHaystack) const
+        {
+            const size_t size = mSequence.size();
+            if (size == 0)
+                return true;
+            if (size > aHaystack.size())
+                return false;
+            const char* needle = mSequence.data();
+            const char last = needle[size - 1];
+            for (const char* window = aHaystack.data(), *end = aHaystack.data() + aHaystack.size() - size; window <= end; window += mSkip[static_cast<unsigned char>(window[size - 1])]) {
+                if (window[size - 1] == last && std::memcmp(window, needle, size - 1) == 0)
+                    return true;
+            }
+            return false;
+        }
+
+      // the same as sequence().find(aNeedle) != std::string::npos
+    inline bool contains(const std::string& aNeedle) const
+        {
+            if (aNeedle.size() < KmerSize || aNeedle.size() > mSequence.size())
+                return mSequence.find(aNeedle) != std::string::npos;
+            if (mIndex.empty()) {
+                if (mScanned < mSequence.size() * IndexCost) {
+                    mScanned += mSequence.size() - aNeedle.size() + 1;
+                    return mSequence.find(aNeedle) != std::string::npos;
+                }
+                make_index();
+            }
+            const auto first = kmer(aNeedle.data());
+            for (auto entry = std::lower_bound(mIndex.begin(), mIndex.end(), std::make_pair(first, size_t(0))); entry != mIndex.end() && entry->first == first; ++entry) {
+                if ((entry->second + aNeedle.size()) <= mSequence.size() && std::memcmp(mSequence.data() + entry->second, aNeedle.data(), aNeedle.size()) == 0)
+                    return true;
+            }
+            return false;
+        }
+
+ private:
+    static constexpr size_t KmerSize = 12;
+    static constexpr size_t IndexCost = 16;
+
+    const std::string& mSequence;
+    const size_t mHash;
+    std::array<size_t, 256> mSkip;
+    mutable std::vector<std::pair<uint64_t, size_t>> mIndex; // k-mer, position; sorted
+    mutable size_t mScanned = 0; // positions scanned by find() before making mIndex
+
+    static inline uint64_t kmer(const char* aStart)
+        {
+            uint64_t result = 0;
+            for (size_t pos = 0; pos < KmerSize; ++pos)
+                result = result * 0x100000001B3ULL + static_cast<unsigned char>(aStart[pos]);
+            return result;
+        }
+
+    inline void make_index() const
+        {
+            mIndex.reserve(mSequence.size() - KmerSize + 1);
+            for (size_t pos = 0; (pos + KmerSize) <= mSequence.size(); ++pos)
+                mIndex.emplace_back(kmer(mSequence.data() + pos), pos);
+            std::sort(mIndex.begin(), mIndex.end());
+        }
+
+}; // class SequenceMatcher
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
@@ -0,0 +1,206 @@
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+
+#include "sequence-sketch.hh"
+
+// ----------------------------------------------------------------------
+
+constexpr size_t SequenceSketch::NumberOfBins;
+constexpr SequenceSketch::Value SequenceSketch::Empty;
+constexpr size_t SequenceSketchIndex::RowsPerBand;
+constexpr size_t SequenceSketchIndex::BandStride;
+constexpr size_t SequenceSketchIndex::NumberOfBands;
+
+// ----------------------------------------------------------------------
+
+namespace
+{
+    constexpr uint64_t HashBase = 0x100000001B3ULL;
+    constexpr size_t BinBits = 6;  // log2(NumberOfBins)
+    static_assert((size_t(1) << BinBits) == SequenceSketch::NumberOfBins, "BinBits does not match NumberOfBins");
+
+      // splitmix64 finalizer, rolling polynomial hash alone does not spread consecutive k-mers over bins
+    inline uint64_t mix(uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+    inline bool valid(char aSymbol, bool aAminoAcids)
+    {
+        if (aAminoAcids)
+            return aSymbol >= 'A' && aSymbol <= 'Z' && aSymbol != 'X';
+        switch (aSymbol) {
+          case 'A': case 'C': case 'G': case 'T': case 'U':
+              return true;
+          default:
+              return false;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------
+
+// k-mers having unknown residues, gaps or stop codons are skipped
+SequenceSketch::SequenceSketch(const std::string& aSequence, bool aAminoAcids)
+{
+    mBins.fill(Empty);
+    const size_t k = kmer_size(aAminoAcids);
+    uint64_t leading_power = 1; // HashBase^(k-1), to remove leading symbol from the rolling hash
+    for (size_t i = 1; i < k; ++i)
+        leading_power *= HashBase;
+    uint64_t hash = 0;
+    size_t valid_run = 0;
+    for (size_t pos = 0; pos < aSequence.size(); ++pos) {
+        const char symbol = aSequence[pos];
+        if (!valid(symbol, aAminoAcids)) {
+            valid_run = 0;
+            hash = 0;
+            continue;
+        }
+        if (valid_run >= k)
+            hash -= static_cast<uint64_t>(aSequence[pos - k]) * leading_power;
+        hash = hash * HashBase + static_cast<uint64_t>(symbol);
+        if (++valid_run >= k) {
+            const uint64_t mixed = mix(hash);
+            auto& bin = mBins[mixed >> (64 - BinBits)];
+            bin = std::min(bin, std::min(static_cast<Value>(mixed), static_cast<Value>(Empty - 1)));
+        }
+    }
+
+} // SequenceSketch::SequenceSketch
+
+// ----------------------------------------------------------------------
+
+double SequenceSketch::jaccard(const SequenceSketch& aNother) const
+{
+      // branchless, so the loop is vectorized by the compiler
+    unsigned equal = 0, filled = 0;
+    for (size_t bin = 0; bin < NumberOfBins; ++bin) {
+        const Value here = mBins[bin], there = aNother.mBins[bin];
+        equal += (here == there) & (here != Empty);
+        filled += (here != Empty) | (there != Empty);
+    }
+    return filled ? static_cast<double>(equal) / static_cast<double>(filled) : 0.0;
+
+} // SequenceSketch::jaccard
+
+// ----------------------------------------------------------------------
+
+double SequenceSketch::identity(double aJaccard, bool aAminoAcids)
+{
+    if (aJaccard <= 0.0)
+        return 0.0;
+    const double distance = - std::log(2.0 * aJaccard / (1.0 + aJaccard)) / static_cast<double>(kmer_size(aAminoAcids));
+    return std::max(0.0, 1.0 - distance);
+
+} // SequenceSketch::identity
+
+// ----------------------------------------------------------------------
+
+SequenceSketchIndex::SequenceSketchIndex(const Seqdb& aSeqdb, bool aAminoAcids)
+    : mAminoAcids(aAminoAcids), mNumberOfSequences(0)
+{
+    std::unordered_map<std::string, size_t> sketch_no; // bins as bytes -> index in mSketches
+    for (auto iter = aSeqdb.begin(); iter != aSeqdb.end(); ++iter) {
+        const auto entry_seq = *iter;
+        if (!entry_seq.seq().aligned())
+            continue;
+        const std::string& sequence = aAminoAcids ? entry_seq.seq().amino_acids_aligned() : entry_seq.seq().nucleotides_aligned();
+        if (sequence.empty())
+            continue;
+        SequenceSketch sketch(sequence, aAminoAcids);
+        const std::string key(reinterpret_cast<const char*>(sketch.bins().data()), sizeof(SequenceSketch::Value) * SequenceSketch::NumberOfBins);
+        const auto inserted = sketch_no.emplace(key, mSketches.size());
+        if (inserted.second) {
+            mSketches.push_back(sketch);
+            mSequences.emplace_back();
+        }
+        mSequences[inserted.first->second].push_back(entry_seq);
+        ++mNumberOfSequences;
+    }
+
+    for (size_t sketch_no = 0; sketch_no < mSketches.size(); ++sketch_no) {
+        for (size_t band = 0; band < NumberOfBands; ++band) {
+            uint64_t key;
+            if (band_key(mSketches[sketch_no], band, key))
+                mBands[band][key].push_back(sketch_no);
+        }
+    }
+
+} // SequenceSketchIndex::SequenceSketchIndex
+
+// ----------------------------------------------------------------------
+
+bool SequenceSketchIndex::band_key(const SequenceSketch& aSketch, size_t aBand, uint64_t& aKey)
+{
+    aKey = 0;
+    for (size_t row = 0; row < RowsPerBand; ++row) {
+        const auto value = aSketch.bins()[(aBand * BandStride + row) % SequenceSketch::NumberOfBins];
+        if (value == SequenceSketch::Empty)
+            return false;
+        aKey = mix(aKey * HashBase + value);
+    }
+    return true;
+
+} // SequenceSketchIndex::band_key
+
+// ----------------------------------------------------------------------
+
+std::vector<std::pair<double, size_t>> SequenceSketchIndex::scores(const SequenceSketch& aQuery, const std::vector<size_t>& aSketchNos) const
+{
+    std::vector<std::pair<double, size_t>> result(aSketchNos.size()); // jaccard, sketch no
+    std::transform(aSketchNos.begin(), aSketchNos.end(), result.begin(), [&](size_t no) { return std::make_pair(aQuery.jaccard(mSketches[no]), no); });
+    return result;
+
+} // SequenceSketchIndex::scores
+
+// ----------------------------------------------------------------------
+
+std::vector<std::pair<SeqdbEntrySeq, double>> SequenceSketchIndex::nearest(const std::string& aSequence, size_t aNumber) const
+{
+    const SequenceSketch query(aSequence, mAminoAcids);
+
+    std::vector<size_t> candidates;
+    for (size_t band = 0; band < NumberOfBands; ++band) {
+        uint64_t key;
+        if (band_key(query, band, key)) {
+            const auto found = mBands[band].find(key);
+            if (found != mBands[band].end())
+                candidates.insert(candidates.end(), found->second.begin(), found->second.end());
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    size_t candidate_sequences = 0;
+    for (auto sketch_no: candidates)
+        candidate_sequences += mSequences[sketch_no].size();
+    if (candidate_sequences < aNumber) { // too few similar sketches, compare with all
+        candidates.resize(mSketches.size());
+        std::iota(candidates.begin(), candidates.end(), 0);
+    }
+
+    auto scores = this->scores(query, candidates);
+      // every sketch has at least one sequence, so aNumber best sketches are enough
+    const auto last = scores.begin() + static_cast<decltype(scores)::difference_type>(std::min(aNumber, scores.size()));
+    std::partial_sort(scores.begin(), last, scores.end(), [](const auto& a, const auto& b) { return a.first > b.first || (a.first == b.first && a.second < b.second); });
+
+    std::vector<std::pair<SeqdbEntrySeq, double>> result;
+    for (auto score = scores.begin(); score != last && result.size() < aNumber; ++score) {
+        const double identity = SequenceSketch::identity(score->first, mAminoAcids);
+        for (const auto& entry_seq: mSequences[score->second]) {
+            if (result.size() >= aNumber)
+                break;
+            result.emplace_back(entry_seq, identity);
+        }
+    }
+    return result;
+
+} // SequenceSketchIndex::nearest
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+
+#include "seqdb.hh"
+
+// ----------------------------------------------------------------------
+
+// One permutation MinHash sketch of the k-mers of a sequence: k-mers
+// are hashed, the hash selects a bin, each bin keeps the minimal
+// value. Fraction of the bins with equal values in two sketches
+// estimates Jaccard similarity of their k-mer sets.
+
+class SequenceSketch
+{
+ public:
+    static constexpr size_t NumberOfBins = 64;
+    typedef uint32_t Value;
+    static constexpr Value Empty = ~Value(0);
+
+    SequenceSketch(const std::string& aSequence, bool aAminoAcids);
+
+    double jaccard(const SequenceSketch& aNother) const;
+    inline const std::array<Value, NumberOfBins>& bins() const { return mBins; }
+
+      // k-mer identity estimated from Jaccard similarity (Mash distance)
+    static double identity(double aJaccard, bool aAminoAcids);
+    static constexpr size_t kmer_size(bool aAminoAcids) { return aAminoAcids ? 5 : 15; }
+
+ private:
+    std::array<Value, NumberOfBins> mBins;
+
+}; // class SequenceSketch
+
+// ----------------------------------------------------------------------
+
+// Index of sketches of the aligned sequences in seqdb, used to find
+// closest existing sequences. Sequences with the same sketch (mostly
+// identical ones) share one entry. Sketches are grouped by the values
+// of RowsPerBand consecutive bins (LSH banding), bands start every
+// BandStride bins and overlap. A query compares only sketches having
+// all bins of at least one band equal to the query (probability is
+// J^RowsPerBand per band for Jaccard similarity J, i.e. close sequences
+// are found with high probability), if they have less than the
+// requested number of sequences, all sketches are compared. Index keeps
+// pointers to seqdb entries, seqdb must not be modified while index is
+// used.
+
+class SequenceSketchIndex
+{
+ public:
+    SequenceSketchIndex(const Seqdb& aSeqdb, bool aAminoAcids);
+
+      // top aNumber sequences with estimated identity, highest identity first, sequences with the same sketch are in seqdb order
+      // (approximate: sequences much less similar than the closest ones may be missed)
+    std::vector<std::pair<SeqdbEntrySeq, double>> nearest(const std::string& aSequence, size_t aNumber) const;
+
+    inline size_t number_of_sequences() const { return mNumberOfSequences; }
+    inline size_t number_of_sketches() const { return mSketches.size(); }
+
+    static constexpr size_t RowsPerBand = 8;
+    static constexpr size_t BandStride = 4;
+    static constexpr size_t NumberOfBands = SequenceSketch::NumberOfBins / BandStride;
+
+ private:
+    bool mAminoAcids;
+    size_t mNumberOfSequences;
+    std::vector<SequenceSketch> mSketches;
+    std::vector<std::vector<SeqdbEntrySeq>> mSequences; // sequences having mSketches[no]
+    std::array<std::unordered_map<uint64_t, std::vector<size_t>>, NumberOfBands> mBands; // band key -> sketch nos, bands having empty bins are not keyed
+
+      // returns false if band has empty bins
+    static bool band_key(const SequenceSketch& aSketch, size_t aBand, uint64_t& aKey);
+    std::vector<std::pair<double, size_t>> scores(const SequenceSketch& aQuery, const std::vector<size_t>& aSketchNos) const;
+
+}; // class SequenceSketchIndex
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
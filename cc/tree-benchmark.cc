@@ -0,0 +1,87 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <sys/resource.h>
+
+#include "tree.hh"
+#include "tree-import.hh"
+
+// ----------------------------------------------------------------------
+
+// Time of the tree passes done for every signature page: import,
+// ladderize, make_aa_transitions and re-rooting at leaves spread over
+// the tree, plus peak memory. Only the Tree interface that exists since
+// long ago is used, build this program at different revisions to
+// compare them. Random trees for it are made by
+// python/seqdb/random_tree.py (see sbin/seqdb-tree-benchmark, which
+// also times drawing via the python module).
+//   dist/tree-benchmark <tree.json|tree.newick> [repeat]
+
+static inline long peak_rss_kb()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+
+} // peak_rss_kb
+
+// ----------------------------------------------------------------------
+
+int main(int argc, const char *argv[])
+{
+    int exit_code = 0;
+    try {
+        if (argc < 2 || argc > 3)
+            throw std::runtime_error(std::string("Usage: ") + argv[0] + " <tree.json|tree.newick> [repeat]");
+        const int repeat = argc > 2 ? std::max(1, std::atoi(argv[2])) : 3;
+        constexpr size_t number_of_re_roots = 8;
+        std::vector<std::pair<std::string, std::vector<double>>> timings; // in the order of passes
+        auto timed = [&timings](std::string aName, auto aFunc) {
+            const auto start = std::chrono::steady_clock::now();
+            aFunc();
+            const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            auto found = std::find_if(timings.begin(), timings.end(), [&aName](const auto& e) { return e.first == aName; });
+            if (found == timings.end())
+                found = timings.emplace(timings.end(), aName, std::vector<double>{});
+            found->second.push_back(elapsed.count());
+        };
+
+        size_t number_of_leaves = 0;
+        long rss_before_re_root = 0; // of the first run, re-rooting in the later runs would be counted otherwise
+        for (int run = 0; run < repeat; ++run) {
+            std::unique_ptr<Tree> tree;
+            timed("import", [&]() { tree.reset(import_tree(argv[1])); });
+            timed("ladderize max-edge-length", [&]() { tree->ladderize(Tree::LadderizeMethod::MaxEdgeLength); });
+            timed("ladderize number-of-leaves", [&]() { tree->ladderize(Tree::LadderizeMethod::NumberOfLeaves); });
+            timed("make_aa_transitions", [&]() { tree->make_aa_transitions(); });
+            const auto names = tree->names();
+            number_of_leaves = names.size();
+            if (run == 0)
+                rss_before_re_root = peak_rss_kb();
+            timed("re_root x" + std::to_string(number_of_re_roots), [&]() {
+                for (size_t re_root_no = 1; re_root_no <= number_of_re_roots; ++re_root_no)
+                    tree->re_root(names[names.size() * re_root_no / (number_of_re_roots + 1)]);
+            });
+        }
+
+        std::cout << argv[1] << ": " << number_of_leaves << " leaves, best of " << repeat << std::endl;
+        for (const auto& timing: timings)
+            std::cout << "  " << std::left << std::setw(28) << timing.first << std::right << std::setw(10) << std::fixed << std::setprecision(1) << *std::min_element(timing.second.begin(), timing.second.end()) << " ms" << std::endl;
+        std::cout << "  peak rss before re_root     " << std::setw(10) << rss_before_re_root << " kb" << std::endl;
+        std::cout << "  peak rss                    " << std::setw(10) << peak_rss_kb() << " kb" << std::endl;
+    }
+    catch (std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        exit_code = 1;
+    }
+    return exit_code;
+}
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
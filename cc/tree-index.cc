@@ -0,0 +1,123 @@
+#include <algorithm>
+
+#include "tree-index.hh"
+#include "tree.hh"
+
+// ----------------------------------------------------------------------
+
+constexpr const TreeIndex::NodeNo TreeIndex::NoNode;
+
+// ----------------------------------------------------------------------
+
+void TreeIndex::make(Node& aRoot)
+{
+    clear();
+    std::vector<NodeNo> last_child;
+    std::vector<std::pair<Node*, NodeNo>> to_visit{{&aRoot, NoNode}}; // node, its parent number
+    while (!to_visit.empty()) {
+        Node* node = to_visit.back().first;
+        const NodeNo parent = to_visit.back().second;
+        to_visit.pop_back();
+
+        const NodeNo no = mNode.size();
+        mNode.push_back(node);
+        mNodeNo.emplace(node, no);
+        mParent.push_back(parent);
+        mFirstChild.push_back(NoNode);
+        mNextSibling.push_back(NoNode);
+        mSubtreeEnd.push_back(no + 1);
+        mIsLeaf.push_back(node->is_leaf());
+        mEdgeLength.push_back(node->edge_length);
+        last_child.push_back(NoNode);
+        if (node->is_leaf())
+            mLeaves.push_back(no);
+        if (parent != NoNode) {
+            if (last_child[parent] == NoNode)
+                mFirstChild[parent] = no;
+            else
+                mNextSibling[last_child[parent]] = no;
+            last_child[parent] = no;
+        }
+        for (auto child = node->subtree.rbegin(); child != node->subtree.rend(); ++child)
+            to_visit.emplace_back(&*child, no);
+    }
+
+    for (NodeNo no = mNode.size() - 1; no > 0; --no)
+        mSubtreeEnd[mParent[no]] = std::max(mSubtreeEnd[mParent[no]], mSubtreeEnd[no]);
+    mShownLeafPosition.assign(mNode.size(), NoNode);
+
+} // TreeIndex::make
+
+// ----------------------------------------------------------------------
+
+void TreeIndex::set_shown_leaves(std::vector<NodeNo>&& aShownLeaves)
+{
+    for (auto no: mShownLeaves)
+        mShownLeafPosition[no] = NoNode;
+    mShownLeaves = std::move(aShownLeaves);
+    for (size_t pos = 0; pos < mShownLeaves.size(); ++pos)
+        mShownLeafPosition[mShownLeaves[pos]] = pos;
+
+} // TreeIndex::set_shown_leaves
+
+// ----------------------------------------------------------------------
+
+const TreeIndex::Names& TreeIndex::names() const
+{
+    if (mNames.empty() && !mNode.empty()) {
+        for (NodeNo no = 0; no < mNode.size(); ++no) {
+            const auto& node = *mNode[no];
+            mNames.node_by_name.emplace(node.name, no);
+            mNames.node_by_branch_id.emplace(node.branch_id, no);
+            if (mIsLeaf[no]) {
+                mNames.leaf_by_name.emplace(node.name, no);
+                mNames.leaves_by_name.emplace_back(node.name, no);
+            }
+        }
+        std::sort(mNames.leaves_by_name.begin(), mNames.leaves_by_name.end());
+    }
+    return mNames;
+
+} // TreeIndex::names
+
+// ----------------------------------------------------------------------
+
+TreeIndex::NodeNo TreeIndex::find_node_by_name(const std::string& aName) const
+{
+    return find_in(names().node_by_name, aName);
+
+} // TreeIndex::find_node_by_name
+
+// ----------------------------------------------------------------------
+
+TreeIndex::NodeNo TreeIndex::find_leaf_by_name(const std::string& aName) const
+{
+    return find_in(names().leaf_by_name, aName);
+
+} // TreeIndex::find_leaf_by_name
+
+// ----------------------------------------------------------------------
+
+TreeIndex::NodeNo TreeIndex::find_node_by_branch_id(const std::string& aBranchId) const
+{
+    return find_in(names().node_by_branch_id, aBranchId);
+
+} // TreeIndex::find_node_by_branch_id
+
+// ----------------------------------------------------------------------
+
+std::vector<TreeIndex::NodeNo> TreeIndex::find_leaves_by_name_prefix(const std::string& aPrefix) const
+{
+    const auto& leaves_by_name = names().leaves_by_name;
+    std::vector<NodeNo> result;
+    for (auto entry = std::lower_bound(leaves_by_name.begin(), leaves_by_name.end(), std::make_pair(aPrefix, NodeNo(0))); entry != leaves_by_name.end() && entry->first.compare(0, aPrefix.size(), aPrefix) == 0; ++entry)
+        result.push_back(entry->second);
+    std::sort(result.begin(), result.end());
+    return result;
+
+} // TreeIndex::find_leaves_by_name_prefix
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// ----------------------------------------------------------------------
+
+class Node;
+
+// ----------------------------------------------------------------------
+
+// Flat (struct of arrays) representation of the Node hierarchy of a
+// Tree. Nodes are numbered in the pre-order (the order nodes are drawn),
+// the root is 0, parent/child/sibling links and frequently read fields
+// are stored in columns indexed by the node number. Passes over the whole
+// tree are loops over node numbers: forward loop visits parents before
+// children, backward loop visits children before parents.
+// Nodes are still owned by the Node::subtree vectors, the index keeps
+// pointers to them and therefore must be re-made upon any change of the
+// tree structure (see Tree::index() and Tree::structure_changed()).
+
+class TreeIndex
+{
+ public:
+    typedef size_t NodeNo;
+    static constexpr const NodeNo NoNode = static_cast<NodeNo>(-1);
+
+    inline TreeIndex() = default;
+      // copy of Tree gets its own index made upon the first use
+    inline TreeIndex(const TreeIndex&) : TreeIndex() {}
+    inline TreeIndex& operator=(const TreeIndex&) { clear(); return *this; }
+
+    void make(Node& aRoot);
+
+    inline void clear()
+        {
+            mNode.clear();
+            mParent.clear();
+            mFirstChild.clear();
+            mNextSibling.clear();
+            mSubtreeEnd.clear();
+            mIsLeaf.clear();
+            mEdgeLength.clear();
+            mLeaves.clear();
+            mNodeNo.clear();
+            mShownLeaves.clear();
+            mShownLeafPosition.clear();
+            names_changed();
+        }
+
+    inline bool empty() const { return mNode.empty(); }
+    inline size_t size() const { return mNode.size(); }
+
+    inline Node& node(NodeNo aNo) const { return *mNode[aNo]; }
+    inline NodeNo parent(NodeNo aNo) const { return mParent[aNo]; }
+    inline NodeNo first_child(NodeNo aNo) const { return mFirstChild[aNo]; }
+    inline NodeNo next_sibling(NodeNo aNo) const { return mNextSibling[aNo]; }
+      // descendants of aNo are numbered (aNo, subtree_end(aNo))
+    inline NodeNo subtree_end(NodeNo aNo) const { return mSubtreeEnd[aNo]; }
+    inline bool is_leaf(NodeNo aNo) const { return mIsLeaf[aNo] != 0; }
+    inline double edge_length(NodeNo aNo) const { return mEdgeLength[aNo]; }
+
+      // leaf node numbers in the pre-order
+    inline const std::vector<NodeNo>& leaves() const { return mLeaves; }
+
+      // NoNode if aNode is not in the tree
+    inline NodeNo node_no(const Node& aNode) const { const auto found = mNodeNo.find(&aNode); return found == mNodeNo.end() ? NoNode : found->second; }
+
+      // leaves shown (not hidden) in the order of their lines, set by Tree::set_line_no()
+    void set_shown_leaves(std::vector<NodeNo>&& aShownLeaves);
+      // NoNode if aNo is not shown or it is the last/first shown leaf
+    inline NodeNo next_shown_leaf(NodeNo aNo) const { const auto pos = mShownLeafPosition[aNo]; return (pos == NoNode || (pos + 1) >= mShownLeaves.size()) ? NoNode : mShownLeaves[pos + 1]; }
+    inline NodeNo previous_shown_leaf(NodeNo aNo) const { const auto pos = mShownLeafPosition[aNo]; return (pos == NoNode || pos == 0) ? NoNode : mShownLeaves[pos - 1]; }
+
+      // lookups by name and branch_id, tables are made upon the first lookup, call names_changed() if names or branch ids are modified
+      // the first node (leaf) in the pre-order is returned if there are several, NoNode if not found
+    NodeNo find_node_by_name(const std::string& aName) const;
+    NodeNo find_leaf_by_name(const std::string& aName) const;
+    NodeNo find_node_by_branch_id(const std::string& aBranchId) const;
+      // leaves having names starting with aPrefix, in the pre-order
+    std::vector<NodeNo> find_leaves_by_name_prefix(const std::string& aPrefix) const;
+    inline void names_changed() { mNames.clear(); }
+
+ private:
+    std::vector<Node*> mNode;
+    std::vector<NodeNo> mParent;
+    std::vector<NodeNo> mFirstChild;
+    std::vector<NodeNo> mNextSibling;
+    std::vector<NodeNo> mSubtreeEnd;
+    std::vector<unsigned char> mIsLeaf;
+    std::vector<double> mEdgeLength;
+    std::vector<NodeNo> mLeaves;
+    std::unordered_map<const Node*, NodeNo> mNodeNo;
+    std::vector<NodeNo> mShownLeaves;
+    std::vector<size_t> mShownLeafPosition; // indexed by node number, position in mShownLeaves or NoNode
+
+    class Names
+    {
+     public:
+        inline bool empty() const { return leaves_by_name.empty(); }
+        inline void clear() { node_by_name.clear(); leaf_by_name.clear(); node_by_branch_id.clear(); leaves_by_name.clear(); }
+
+        std::unordered_map<std::string, NodeNo> node_by_name, leaf_by_name, node_by_branch_id;
+        std::vector<std::pair<std::string, NodeNo>> leaves_by_name; // sorted by name
+    };
+
+    mutable Names mNames;
+
+    const Names& names() const;
+    static inline NodeNo find_in(const std::unordered_map<std::string, NodeNo>& aTable, const std::string& aKey) { const auto found = aTable.find(aKey); return found == aTable.end() ? NoNode : found->second; }
+
+}; // class TreeIndex
+
+// ----------------------------------------------------------------------
+/// Local Variables:
+/// eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+/// End:
@@ -10,6 +10,9 @@
 #include <unistd.h>
 #include <cstring>
 #include <numeric>
+#include <array>
+#include <thread>
+#include <stdexcept>
 
 #include "tree.hh"
 #include "seqdb.hh"
@@ -54,69 +57,119 @@ std::string Node::display_name() const
 
 // ----------------------------------------------------------------------
 
-void Node::ladderize(LadderizeMethod aLadderizeMethod)
+void Tree::ladderize(LadderizeMethod aLadderizeMethod)
 {
-    auto set_max_edge = [](Node& aNode) {
-        aNode.ladderize_max_edge_length = aNode.edge_length;
-        aNode.ladderize_max_date = aNode.date;
-        aNode.ladderize_max_name_alphabetically = aNode.name;
-    };
-
-    auto compute_max_edge = [](Node& aNode) {
-        auto const max_subtree_edge_node = std::max_element(aNode.subtree.begin(), aNode.subtree.end(), [](auto const& a, auto const& b) { return a.ladderize_max_edge_length < b.ladderize_max_edge_length; });
-        aNode.ladderize_max_edge_length = aNode.edge_length + max_subtree_edge_node->ladderize_max_edge_length;
-        aNode.ladderize_max_date = std::max_element(aNode.subtree.begin(), aNode.subtree.end(), [](auto const& a, auto const& b) { return a.ladderize_max_date < b.ladderize_max_date; })->ladderize_max_date;
-        aNode.ladderize_max_name_alphabetically = std::max_element(aNode.subtree.begin(), aNode.subtree.end(), [](auto const& a, auto const& b) { return a.ladderize_max_name_alphabetically < b.ladderize_max_name_alphabetically; })->ladderize_max_name_alphabetically;
-    };
-
-      // set max_edge_length field for every node
-    iterate_leaf_post(*this, set_max_edge, compute_max_edge);
+    const auto& tree_index = index();
+
+      // max edge length, date and name in each subtree, children before parents
+    std::vector<double> max_edge_length(tree_index.size());
+    std::vector<const Date*> max_date(tree_index.size());
+    std::vector<const std::string*> max_name_alphabetically(tree_index.size());
+    for (auto no = tree_index.size(); no > 0; --no) {
+        const auto node_no = no - 1;
+        const Node& node = tree_index.node(node_no);
+        auto child_no = tree_index.first_child(node_no);
+        if (child_no == TreeIndex::NoNode) {
+            max_edge_length[node_no] = node.edge_length;
+            max_date[node_no] = &node.date;
+            max_name_alphabetically[node_no] = &node.name;
+        }
+        else {
+            double subtree_max_edge_length = max_edge_length[child_no];
+            max_date[node_no] = max_date[child_no];
+            max_name_alphabetically[node_no] = max_name_alphabetically[child_no];
+            for (child_no = tree_index.next_sibling(child_no); child_no != TreeIndex::NoNode; child_no = tree_index.next_sibling(child_no)) {
+                if (subtree_max_edge_length < max_edge_length[child_no])
+                    subtree_max_edge_length = max_edge_length[child_no];
+                if (*max_date[node_no] < *max_date[child_no])
+                    max_date[node_no] = max_date[child_no];
+                if (*max_name_alphabetically[node_no] < *max_name_alphabetically[child_no])
+                    max_name_alphabetically[node_no] = max_name_alphabetically[child_no];
+            }
+            max_edge_length[node_no] = node.edge_length + subtree_max_edge_length;
+        }
+    }
 
-    auto reorder_by_max_edge_length = [](const Node& a, const Node& b) -> bool {
+    auto reorder_by_max_edge_length = [&](TreeIndex::NodeNo a, TreeIndex::NodeNo b) -> bool {
         bool r = false;
-        if (float_equal(a.ladderize_max_edge_length, b.ladderize_max_edge_length)) {
-            if (a.ladderize_max_date == b.ladderize_max_date) {
-                r = a.ladderize_max_name_alphabetically < b.ladderize_max_name_alphabetically;
+        if (float_equal(max_edge_length[a], max_edge_length[b])) {
+            if (*max_date[a] == *max_date[b]) {
+                r = *max_name_alphabetically[a] < *max_name_alphabetically[b];
             }
             else {
-                r = a.ladderize_max_date < b.ladderize_max_date;
+                r = *max_date[a] < *max_date[b];
             }
         }
         else {
-            r = a.ladderize_max_edge_length < b.ladderize_max_edge_length;
+            r = max_edge_length[a] < max_edge_length[b];
         }
         return r;
     };
 
-    auto reorder_by_number_of_leaves = [&reorder_by_max_edge_length](const Node& a, const Node& b) -> bool {
+    auto reorder_by_number_of_leaves = [&](TreeIndex::NodeNo a, TreeIndex::NodeNo b) -> bool {
         bool r = false;
-        if (a.number_strains == b.number_strains) {
+        const auto a_strains = tree_index.node(a).number_strains, b_strains = tree_index.node(b).number_strains;
+        if (a_strains == b_strains) {
             r = reorder_by_max_edge_length(a, b);
         }
         else {
-            r = a.number_strains < b.number_strains;
+            r = a_strains < b_strains;
         }
         return r;
     };
 
-    switch (aLadderizeMethod) {
-      case LadderizeMethod::MaxEdgeLength:
-          iterate_post(*this, [&reorder_by_max_edge_length](Node& aNode) { std::sort(aNode.subtree.begin(), aNode.subtree.end(), reorder_by_max_edge_length); });
-          break;
-      case LadderizeMethod::NumberOfLeaves:
-          iterate_post(*this, [&reorder_by_number_of_leaves](Node& aNode) { std::sort(aNode.subtree.begin(), aNode.subtree.end(), reorder_by_number_of_leaves); });
-          break;
+      // new order of children (their positions in subtree) for each node which children are to be reordered, children before parents
+    std::vector<std::pair<TreeIndex::NodeNo, std::vector<size_t>>> to_reorder;
+    std::vector<TreeIndex::NodeNo> children;
+    for (auto no = tree_index.size(); no > 0; --no) {
+        children.clear();
+        for (auto child_no = tree_index.first_child(no - 1); child_no != TreeIndex::NoNode; child_no = tree_index.next_sibling(child_no))
+            children.push_back(child_no);
+        if (children.size() > 1) {
+            std::vector<size_t> order(children.size());
+            std::iota(order.begin(), order.end(), 0);
+            switch (aLadderizeMethod) {
+              case LadderizeMethod::MaxEdgeLength:
+                  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return reorder_by_max_edge_length(children[a], children[b]); });
+                  break;
+              case LadderizeMethod::NumberOfLeaves:
+                  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return reorder_by_number_of_leaves(children[a], children[b]); });
+                  break;
+            }
+            if (!std::is_sorted(order.begin(), order.end()))
+                to_reorder.emplace_back(no - 1, std::move(order));
+        }
     }
 
-} // Node::ladderize
+      // branch ids change in the subtrees of the reordered nodes only, nodes not having reordered ancestors are not moved
+    std::vector<bool> reordered(tree_index.size(), false);
+    for (const auto& node_order: to_reorder)
+        reordered[node_order.first] = true;
+    std::vector<Node*> reordered_subtrees;
+    for (TreeIndex::NodeNo no = 0; no < tree_index.size(); ) {
+        if (reordered[no]) {
+            reordered_subtrees.push_back(&tree_index.node(no));
+            no = tree_index.subtree_end(no);
+        }
+        else
+            ++no;
+    }
 
-// ----------------------------------------------------------------------
+      // moving children of the node moves its whole subtree, the node itself stays in place until its parent is reordered
+    for (const auto& node_order: to_reorder) {
+        auto& subtree = tree_index.node(node_order.first).subtree;
+        Subtree reordered;
+        reordered.reserve(subtree.size());
+        for (size_t child_pos: node_order.second)
+            reordered.push_back(std::move(subtree[child_pos]));
+        subtree.swap(reordered);
+    }
+    structure_changed();
 
-void Tree::ladderize(LadderizeMethod aLadderizeMethod)
-{
-    Node::ladderize(aLadderizeMethod);
     std::cerr << "WARNING: ladderizing destroys hz line sections" << std::endl;
-    set_branch_id();
+    for (auto subtree_root: reordered_subtrees)
+        set_branch_id(*subtree_root);
+    mIndex.names_changed();
     init_hz_line_sections(true);
 
 } // Tree::ladderize
@@ -125,13 +178,17 @@ void Tree::ladderize(LadderizeMethod aLadderizeMethod)
 
 void Tree::preprocess_upon_importing_from_external_format()
 {
-    auto set_number_strains = [](Node& aNode) {
-        aNode.number_strains = 0;
-        for (const auto& subnode: aNode.subtree) {
-            aNode.number_strains += subnode.number_strains;
+    structure_changed();
+    const auto& tree_index = index();
+    for (auto no = tree_index.size(); no > 0; --no) {
+        if (!tree_index.is_leaf(no - 1)) {
+            auto& node = tree_index.node(no - 1);
+            node.number_strains = 0;
+            for (const auto& subnode: node.subtree) {
+                node.number_strains += subnode.number_strains;
+            }
         }
-    };
-    iterate_post(*this, set_number_strains);
+    }
 
     set_branch_id();
     init_hz_line_sections();
@@ -142,15 +199,23 @@ void Tree::preprocess_upon_importing_from_external_format()
 
 void Tree::set_branch_id()
 {
-    auto set_branch_id = [](Node& aNode) {
+    set_branch_id(*this);
+    mIndex.names_changed();
+
+} // Tree::set_branch_id
+
+// ----------------------------------------------------------------------
+
+void Tree::set_branch_id(Node& aSubtreeRoot)
+{
+    auto set_children_branch_id = [](Node& aNode) {
         std::string prefix = aNode.branch_id;
         if (!prefix.empty())
             prefix += ":";
-        for (size_t i = 0; i < aNode.subtree.size(); ++i) {
+        for (size_t i = 0; i < aNode.subtree.size(); ++i)
             aNode.subtree[i].branch_id = prefix + std::to_string(i + 1);
-        }
     };
-    iterate_pre(*this, set_branch_id);
+    iterate_pre(aSubtreeRoot, set_children_branch_id);
 
 } // Tree::set_branch_id
 
@@ -171,60 +236,61 @@ void Tree::init_hz_line_sections(bool reset)
 
 // ----------------------------------------------------------------------
 
-void Tree::set_line_no()
+void Tree::set_line_no(const HzLineSections& aSections)
 {
+      // vertical gap before the first node of each hz line section (except the first one)
+    std::map<std::string, size_t> gap_before;
+    if (aSections.vertical_gap > 0) {
+        for (size_t section_no = 1; section_no < aSections.size(); ++section_no)
+            gap_before.emplace(aSections[section_no].first_name, aSections.vertical_gap);
+    }
+
     size_t current_line = 0;
-    auto set_line_no = [&current_line](Node& aNode) {
-        current_line += aNode.vertical_gap_before;
-        if (!aNode.hidden) {
-            aNode.line_no = current_line;
+    const auto& tree_index = index();
+    std::vector<TreeIndex::NodeNo> shown_leaves;
+    for (auto leaf_no: tree_index.leaves()) {
+        auto& leaf = tree_index.node(leaf_no);
+        if (!gap_before.empty()) {
+            const auto gap = gap_before.find(leaf.name);
+            if (gap != gap_before.end()) {
+                current_line += gap->second;
+                gap_before.erase(gap);
+            }
+        }
+        if (!leaf.hidden) {
+            leaf.line_no = current_line;
             ++current_line;
+            shown_leaves.push_back(leaf_no);
         }
-    };
-    iterate_leaf(*this, set_line_no);
+    }
+    if (!gap_before.empty())
+        throw std::runtime_error("Cannot process hz-line-section: \"" + gap_before.begin()->first + "\" not found in the tree");
+    mIndex.set_shown_leaves(std::move(shown_leaves));
     std::cout << "Lines: " << current_line << std::endl;
 
 } // Tree::set_line_no
 
 // ----------------------------------------------------------------------
 
-void Tree::set_top_bottom()
-{
-    auto set_top_bottom = [](Node& aNode) {
-        if (!aNode.hidden) {
-            aNode.top = -1;
-            for (const auto& node: aNode.subtree) {
-                if (!node.hidden) {
-                    aNode.bottom = node.middle();
-                    if (aNode.top < 0)
-                        aNode.top = aNode.bottom;
-                }
-            }
-        }
-    };
-    iterate_post(*this, set_top_bottom);
-
-} // Tree::set_top_bottom
-
-// ----------------------------------------------------------------------
-
 void Tree::hide_leaves(const SettingsDrawTree& aSettings)
 {
-    auto hide_show_leaf = [&aSettings](Node& aNode) {
-        aNode.hidden = aNode.date < aSettings.hide_isolated_before || aNode.cumulative_edge_length > aSettings.hide_if_cumulative_edge_length_bigger_than;
-    };
-
-    auto hide_show_branch = [](Node& aNode) {
-        aNode.hidden = true;
-        for (const auto& node: aNode.subtree) {
-            if (!node.hidden) {
-                aNode.hidden = false;
-                break;
+    compute_cumulative_edge_length();
+    const auto& tree_index = index();
+    for (auto no = tree_index.size(); no > 0; --no) {
+        auto& node = tree_index.node(no - 1);
+        if (tree_index.is_leaf(no - 1)) {
+            node.hidden = node.date < aSettings.hide_isolated_before || node.cumulative_edge_length > aSettings.hide_if_cumulative_edge_length_bigger_than;
+        }
+        else {
+            node.hidden = true;
+            for (auto child_no = tree_index.first_child(no - 1); child_no != TreeIndex::NoNode; child_no = tree_index.next_sibling(child_no)) {
+                if (!tree_index.node(child_no).hidden) {
+                    node.hidden = false;
+                    break;
+                }
             }
         }
-    };
-
-    iterate_leaf_post(*this, hide_show_leaf, hide_show_branch);
+    }
 
 } // Tree::hide_leaves
 
@@ -295,8 +361,12 @@ std::pair<double, double> Tree::min_max_edge() const
 
 std::pair<const Node*, const Node*> Tree::top_bottom_nodes_of_subtree(std::string branch_id) const
 {
-    const Node* root = find_node(*this, [branch_id](const Node& aNode) -> bool { return aNode.branch_id == branch_id; });
-    return std::make_pair(root != nullptr ? &find_first_leaf(*root) : nullptr, root != nullptr ? &find_last_leaf(*root) : nullptr);
+    const auto& tree_index = index();
+    const auto root_no = tree_index.find_node_by_branch_id(branch_id);
+    if (root_no == TreeIndex::NoNode)
+        return std::make_pair(nullptr, nullptr);
+    const Node& root = tree_index.node(root_no);
+    return std::make_pair(&find_first_leaf(root), &find_last_leaf(root));
 
 } // Tree::top_bottom_nodes_of_subtree
 
@@ -368,6 +438,7 @@ void Tree::fix_labels()
         }
     };
     iterate_leaf(*this, fix_human);
+    mIndex.names_changed();
 
 } // Tree::fix_labels
 
@@ -376,8 +447,7 @@ void Tree::fix_labels()
 void Tree::prepare_for_drawing(const SettingsDrawTree& aSettings)
 {
     hide_leaves(aSettings);
-    set_line_no();
-    set_top_bottom();
+    set_line_no(aSettings.hz_line_sections);
 
 } // Tree::prepare_for_drawing
 
@@ -392,7 +462,7 @@ void Tree::match_seqdb(const Seqdb& aSeqdb)
             aNode.clades = entry_seq.seq().clades();
             aNode.date = entry_seq.entry().date();
             aNode.continent = entry_seq.entry().continent();
-            aNode.aa = entry_seq.seq().amino_acids(true);
+            aNode.aa = entry_seq.seq().amino_acids_aligned();
             ++virus_types[entry_seq.entry().virus_type()];
             ++lineages[entry_seq.entry().lineage()];
             aNode.hi_names = entry_seq.seq().hi_names();
@@ -473,75 +543,253 @@ std::vector<const Node*> Tree::leaves() const
 
 // ----------------------------------------------------------------------
 
-void Tree::make_aa_transitions(const std::vector<size_t>& aPositions)
+void Tree::make_aa_transitions(const std::vector<size_t>& aPositions, size_t aThreads)
 {
+      // positions are split into ranges per thread and looked up by binary search below
+    if (!std::is_sorted(aPositions.begin(), aPositions.end()) || std::adjacent_find(aPositions.begin(), aPositions.end()) != aPositions.end())
+        throw std::invalid_argument("Cannot make aa transitions: positions must be unique and in the ascending order");
+
     std::vector<const Node*> leaf_nodes = leaf_nodes_sorted_by_cumulative_edge_length();
 
       // ?reset aa_transition for all nodes?
 
-    auto make_aa_at = [&](Node& aNode) {
-        aNode.aa.resize(aPositions.back() + 1, AA_Transition::Empty); // actual max length of aa in child leaf nodes may be less than aPositions.back()
-        for (size_t pos: aPositions) {
-            aNode.aa[pos] = 'X';
-            for (const auto& child: aNode.subtree) {
-                if (child.aa.size() > pos && child.aa[pos] != 'X') { // child can be shorter than pos
-                    if (aNode.aa[pos] == 'X')
-                        aNode.aa[pos] = child.aa[pos];
-                    else if (aNode.aa[pos] != child.aa[pos])
-                        aNode.aa[pos] = AA_Transition::Empty;
-                    if (aNode.aa[pos] == AA_Transition::Empty)
-                        break;
+    const auto& tree_index = index();
+
+      // Positions are independent, aPositions are split into contiguous ranges processed in parallel. Each thread
+      // keeps transitions at its positions in its own tables, they are merged below in the order the transitions
+      // would appear when processing all positions in one thread: present before the call, added for the node
+      // itself, added for the node when processing its parent.
+    struct Transitions
+    {
+        std::vector<AA_Transitions> initial, own, from_parent; // indexed by TreeIndex::NodeNo
+    };
+
+      // aa at a node and position is coded in 5 bits: NoAA - leaf sequence is too short, UnknownAA - X, MixedAA - space
+      // (children have different aa), symbols found in the sequences and transitions get codes in the alphabetical order,
+      // if there are too many of them, the rest are coded as OtherAA and compared by the symbol kept in a separate row
+    enum : unsigned char { NoAA = 0, UnknownAA = 1, OtherAA = 30, MixedAA = 31 };
+    std::array<unsigned char, 256> aa_code;
+    std::array<char, MixedAA + 1> aa_of_code;
+    bool other_present = false;
+    {
+        std::array<bool, 256> present{};
+        for (auto leaf_no: tree_index.leaves()) {
+            const auto& leaf_aa = tree_index.node(leaf_no).aa;
+            for (auto pos: aPositions) {
+                if (pos < leaf_aa.size())
+                    present[static_cast<unsigned char>(leaf_aa[pos])] = true;
+            }
+        }
+        for (TreeIndex::NodeNo no = 0; no < tree_index.size(); ++no) {
+            for (const auto& transition: tree_index.node(no).aa_transitions)
+                present[static_cast<unsigned char>(transition.right)] = true;
+        }
+        aa_code.fill(NoAA);
+        aa_code[static_cast<unsigned char>('X')] = UnknownAA;
+        aa_code[static_cast<unsigned char>(AA_Transition::Empty)] = MixedAA;
+        aa_of_code.fill(AA_Transition::Empty);
+        aa_of_code[UnknownAA] = 'X';
+        unsigned char code = UnknownAA + 1;
+        for (size_t symbol = 0; symbol < present.size(); ++symbol) {
+            if (present[symbol] && aa_code[symbol] == NoAA) {
+                if (code == OtherAA) {
+                    aa_code[symbol] = OtherAA;
+                    other_present = true;
+                }
+                else {
+                    aa_code[symbol] = code;
+                    aa_of_code[code] = static_cast<char>(symbol);
+                    ++code;
                 }
             }
-              // If this node has AA_Transition::Empty and a child node has letter, then set aa_transition for the child (unless child is a leaf)
-            if (aNode.aa[pos] == AA_Transition::Empty) {
-                std::map<char, size_t> aa_count;
-                for (auto& child: aNode.subtree) {
-                      // if (!child.is_leaf())
-                    if (child.aa.size() > pos) { // exclude leaf nodes without aa (i.e. not matched agains seqdb, perhaps due to buggy matching)
-                        if (child.aa[pos] != AA_Transition::Empty && child.aa[pos] != 'X') {
-                            child.aa_transitions.add(pos, child.aa[pos]);
-                            ++aa_count[child.aa[pos]];
-                              // std::cout << "aa_transition " << child.aa_transitions << " " << child.name << std::endl;
+        }
+    }
+
+    auto make_aa_at_positions = [&](size_t aFirst, size_t aLast, Transitions& aTransitions) {
+        aTransitions.initial.resize(tree_index.size());
+        aTransitions.own.resize(tree_index.size());
+        aTransitions.from_parent.resize(tree_index.size());
+        for (TreeIndex::NodeNo no = 0; no < tree_index.size(); ++no) {
+            for (const auto& transition: tree_index.node(no).aa_transitions) {
+                if (std::binary_search(aPositions.begin() + static_cast<std::ptrdiff_t>(aFirst), aPositions.begin() + static_cast<std::ptrdiff_t>(aLast), transition.pos))
+                    aTransitions.initial[no].push_back(transition);
+            }
+        }
+
+        auto find = [&](TreeIndex::NodeNo aNodeNo, size_t aPos) -> const AA_Transition* {
+            for (auto* transitions: {&aTransitions.initial, &aTransitions.own, &aTransitions.from_parent}) {
+                if (const auto found = (*transitions)[aNodeNo].find(aPos))
+                    return found;
+            }
+            return nullptr;
+        };
+
+          // see Node::remove_aa_transition(), does not descend into subtrees having transition at aPos
+        auto remove = [&](TreeIndex::NodeNo aNodeNo, size_t aPos, char aRight) {
+            for (auto no = aNodeNo; no < tree_index.subtree_end(aNodeNo); ) {
+                const bool present_any = find(no, aPos) != nullptr;
+                for (auto* transitions: {&aTransitions.initial, &aTransitions.own, &aTransitions.from_parent})
+                    (*transitions)[no].remove(aPos, aRight);
+                no = (present_any && !tree_index.is_leaf(no)) ? tree_index.subtree_end(no) : (no + 1);
+            }
+        };
+
+          // row of aa codes at aPositions[aFirst..aLast) for each node, leaf rows are made from Node::aa
+          // row of symbols coded as OtherAA is used only if such symbols are present
+        const size_t width = aLast - aFirst;
+        std::vector<unsigned char> aa(tree_index.size() * width);
+        std::vector<char> other(other_present ? aa.size() : 0);
+        auto row = [&](TreeIndex::NodeNo aNodeNo) { return aa.data() + aNodeNo * width; };
+        auto other_row = [&](TreeIndex::NodeNo aNodeNo) { return other.data() + aNodeNo * width; };
+        auto aa_at = [&](TreeIndex::NodeNo aNodeNo, size_t aPosNo) -> char {
+            const unsigned char code = row(aNodeNo)[aPosNo];
+            return code == OtherAA ? other_row(aNodeNo)[aPosNo] : aa_of_code[code];
+        };
+        for (auto leaf_no: tree_index.leaves()) {
+            const auto& leaf_aa = tree_index.node(leaf_no).aa;
+            auto leaf_row = row(leaf_no);
+            for (size_t pos_no = aFirst; pos_no < aLast; ++pos_no) {
+                leaf_row[pos_no - aFirst] = aPositions[pos_no] < leaf_aa.size() ? aa_code[static_cast<unsigned char>(leaf_aa[aPositions[pos_no]])] : static_cast<unsigned char>(NoAA);
+                if (leaf_row[pos_no - aFirst] == OtherAA)
+                    other_row(leaf_no)[pos_no - aFirst] = leaf_aa[aPositions[pos_no]];
+            }
+        }
+
+        for (auto node_no = tree_index.size(); node_no > 0; --node_no) {
+            const auto no = node_no - 1;
+            if (tree_index.is_leaf(no))
+                continue;
+              // UnknownAA - no information from children (all X or too short), MixedAA - children have different aa (X not counted), otherwise - all children have the same aa (X not counted)
+            auto node_row = row(no);
+            std::fill(node_row, node_row + width, UnknownAA);
+            for (auto child_no = tree_index.first_child(no); child_no != TreeIndex::NoNode; child_no = tree_index.next_sibling(child_no)) {
+                const auto child_row = row(child_no);
+                if (!other_present) {
+                    for (size_t pos_no = 0; pos_no < width; ++pos_no) {
+                        const unsigned char child_aa = child_row[pos_no], node_aa = node_row[pos_no];
+                        const unsigned char merged = node_aa == UnknownAA ? child_aa : (node_aa == child_aa ? node_aa : static_cast<unsigned char>(MixedAA));
+                        node_row[pos_no] = child_aa > UnknownAA ? merged : node_aa;
+                    }
+                }
+                else {
+                    const auto child_other_row = other_row(child_no);
+                    auto node_other_row = other_row(no);
+                    for (size_t pos_no = 0; pos_no < width; ++pos_no) {
+                        const unsigned char child_aa = child_row[pos_no], node_aa = node_row[pos_no];
+                        if (child_aa <= UnknownAA)
+                            continue;
+                        if (node_aa == UnknownAA) {
+                            node_row[pos_no] = child_aa;
+                            node_other_row[pos_no] = child_other_row[pos_no];
                         }
-                        else {
-                            const auto found = child.aa_transitions.find(pos);
-                            if (found)
-                                ++aa_count[found->right];
+                        else if (node_aa != child_aa || (child_aa == OtherAA && node_other_row[pos_no] != child_other_row[pos_no])) {
+                            node_row[pos_no] = MixedAA;
                         }
                     }
                 }
-                if (!aa_count.empty()) {
-                    const auto max_aa_count = std::max_element(aa_count.begin(), aa_count.end(), [](const auto& e1, const auto& e2) { return e1.second < e2.second; });
-                      // std::cout << "aa_count " << aa_count << "   max: " << max_aa_count->first << ':' << max_aa_count->second << std::endl;
-                    if (max_aa_count->second > 1) {
-                        aNode.remove_aa_transition(pos, max_aa_count->first, false);
-                        aNode.aa_transitions.add(pos, max_aa_count->first);
+            }
+
+              // If this node has MixedAA and a child node has aa, then set aa_transition for the child
+            for (size_t pos_no = 0; pos_no < width; ++pos_no) {
+                if (node_row[pos_no] != MixedAA)
+                    continue;
+                const size_t pos = aPositions[aFirst + pos_no];
+                std::array<size_t, MixedAA + 1> aa_count{};
+                std::map<unsigned char, size_t> other_count; // symbols coded as OtherAA
+                auto count = [&](char aAA) {
+                    const unsigned char code = aa_code[static_cast<unsigned char>(aAA)];
+                    if (code == OtherAA)
+                        ++other_count[static_cast<unsigned char>(aAA)];
+                    else
+                        ++aa_count[code];
+                };
+                for (auto child_no = tree_index.first_child(no); child_no != TreeIndex::NoNode; child_no = tree_index.next_sibling(child_no)) {
+                    const unsigned char child_aa = row(child_no)[pos_no];
+                    if (child_aa > UnknownAA && child_aa < MixedAA) {
+                        const char child_symbol = aa_at(child_no, pos_no);
+                        aTransitions.from_parent[child_no].add(pos, child_symbol);
+                        count(child_symbol);
+                    }
+                    else if (child_aa != NoAA) { // exclude leaf nodes without aa (i.e. not matched agains seqdb, perhaps due to buggy matching)
+                        if (const auto found = find(child_no, pos))
+                            count(found->right);
+                    }
+                }
+                  // the most frequent aa, the first one in the alphabetical order if there are several (OtherAA symbols follow coded ones)
+                size_t max_count = 0;
+                char max_aa = AA_Transition::Empty;
+                auto update_max = [&](size_t aCount, char aAA) {
+                    if (aCount > max_count) {
+                        max_count = aCount;
+                        max_aa = aAA;
                     }
+                };
+                for (unsigned char code = NoAA; code < OtherAA; ++code)
+                    update_max(aa_count[code], aa_of_code[code]);
+                for (const auto& symbol_count: other_count)
+                    update_max(symbol_count.second, static_cast<char>(symbol_count.first));
+                update_max(aa_count[MixedAA], aa_of_code[MixedAA]);
+                if (max_count > 1) {
+                    remove(no, pos, max_aa);
+                    aTransitions.own[no].add(pos, max_aa);
                 }
             }
         }
-          // std::cout << "aa  " << aNode.aa << std::endl;
     };
-    iterate_post(*this, make_aa_at);
+
+    if (aThreads == 0)
+        aThreads = std::max(1U, std::thread::hardware_concurrency());
+    aThreads = std::max(size_t(1), std::min(aThreads, aPositions.size()));
+    std::vector<size_t> first_pos_no(aThreads + 1); // positions aPositions[first_pos_no[thread_no]..first_pos_no[thread_no + 1]) are processed by thread_no
+    for (size_t thread_no = 0; thread_no <= aThreads; ++thread_no)
+        first_pos_no[thread_no] = aPositions.size() * thread_no / aThreads;
+    std::vector<Transitions> transitions(aThreads);
+    if (aThreads == 1) {
+        make_aa_at_positions(0, aPositions.size(), transitions[0]);
+    }
+    else {
+        std::vector<std::thread> workers;
+        for (size_t thread_no = 0; thread_no < aThreads; ++thread_no)
+            workers.emplace_back(make_aa_at_positions, first_pos_no[thread_no], first_pos_no[thread_no + 1], std::ref(transitions[thread_no]));
+        for (auto& worker: workers)
+            worker.join();
+    }
+
+    for (TreeIndex::NodeNo no = 0; no < tree_index.size(); ++no) {
+        auto& node = tree_index.node(no);
+        AA_Transitions merged;
+        for (const auto& transition: node.aa_transitions) {
+            const auto pos_no = std::lower_bound(aPositions.begin(), aPositions.end(), transition.pos);
+            if (pos_no == aPositions.end() || *pos_no != transition.pos) {
+                merged.push_back(transition); // not processed
+            }
+            else {
+                const auto thread_no = static_cast<size_t>(std::upper_bound(first_pos_no.begin(), first_pos_no.end(), static_cast<size_t>(pos_no - aPositions.begin())) - first_pos_no.begin()) - 1;
+                const auto& initial = transitions[thread_no].initial[no];
+                if (std::any_of(initial.begin(), initial.end(), [&](const auto& e) { return e.pos == transition.pos && e.right == transition.right; }))
+                    merged.push_back(transition); // not removed
+            }
+        }
+        for (const auto& thread_transitions: transitions)
+            merged.insert(merged.end(), thread_transitions.own[no].begin(), thread_transitions.own[no].end());
+        for (const auto& thread_transitions: transitions)
+            merged.insert(merged.end(), thread_transitions.from_parent[no].begin(), thread_transitions.from_parent[no].end());
+        node.aa_transitions = std::move(merged);
+    }
 
       // add left part to aa transitions (Derek's algorithm)
     auto add_left_part = [&](Node& aNode) {
         if (!aNode.aa_transitions.empty()) {
             const auto node_left_edge = aNode.cumulative_edge_length - aNode.edge_length;
 
-              // ??? lower bound does not work for sig page
-              // const auto lb = std::lower_bound(leaf_nodes.begin(), leaf_nodes.end(), node_left_edge, [](const Node* a, double b) { return a->cumulative_edge_length < b; });
-
-            auto lb = leaf_nodes.begin();
-            for (auto ln = leaf_nodes.begin() + 1; ln != leaf_nodes.end(); ++ln) {
-                if ((*ln)->cumulative_edge_length < node_left_edge) {
-                    lb = ln;
-                    break;
-                }
+              // leaf_nodes are sorted by cumulative_edge_length in the descending order (std::lower_bound expects ascending),
+              // look for the first one (except the very first) having cumulative_edge_length < node_left_edge, the leaf before it is used for left
+            const Node* node_for_left = nullptr;
+            if (leaf_nodes.size() > 1) {
+                const auto lb = std::partition_point(leaf_nodes.begin() + 1, leaf_nodes.end(), [node_left_edge](const Node* a) { return !(a->cumulative_edge_length < node_left_edge); });
+                if (lb != leaf_nodes.end())
+                    node_for_left = *(lb - 1);
             }
-
-            const Node* node_for_left = lb == leaf_nodes.begin() ? nullptr : *(lb - 1);
             for (auto& transition: aNode.aa_transitions) {
                 if (node_for_left and node_for_left->aa.size() > transition.pos) { // node_for_left can have shorter aa
                     transition.left = node_for_left->aa[transition.pos];
@@ -564,25 +812,20 @@ void Tree::make_aa_transitions(const std::vector<size_t>& aPositions)
             settings().draw_tree.aa_transition.add(aNode.branch_id, aNode.aa_transitions.make_labels());
         }
     };
-    iterate_leaf_pre(*this, add_left_part, add_left_part);
-
-      // cleanup
-    auto erase_aa_at = [&](Node& aNode) {
-        aNode.aa.clear();
-    };
-    iterate_post(*this, erase_aa_at);
+    for (TreeIndex::NodeNo no = 0; no < tree_index.size(); ++no)
+        add_left_part(tree_index.node(no));
 
 } // Tree::make_aa_transitions
 
 // ----------------------------------------------------------------------
 
-void Tree::make_aa_transitions()
+void Tree::make_aa_transitions(size_t aThreads)
 {
     const auto num_positions = longest_aa();
     if (num_positions) {
         std::vector<size_t> all_positions(num_positions);
         std::iota(all_positions.begin(), all_positions.end(), 0);
-        make_aa_transitions(all_positions);
+        make_aa_transitions(all_positions, aThreads);
     }
     else {
         std::cerr << "WARNING: cannot make AA transition labels: no AA sequences present (match with seqdb?)" << std::endl;
@@ -612,19 +855,20 @@ std::vector<std::map<char, size_t>> Tree::aa_per_pos() const
 
 // ----------------------------------------------------------------------
 
-void Node::compute_cumulative_edge_length(double initial_edge_length, double& max_cumulative_edge_length) const
+void Tree::compute_cumulative_edge_length() const
 {
-    cumulative_edge_length = initial_edge_length + edge_length;
-    if (!is_leaf()) {
-        for (auto& node: subtree) {
-            node.compute_cumulative_edge_length(cumulative_edge_length, max_cumulative_edge_length);
+    if (mMaxCumulativeEdgeLength < 0) {
+        const auto& tree_index = index();
+        for (TreeIndex::NodeNo no = 0; no < tree_index.size(); ++no) {
+            const auto parent = tree_index.parent(no);
+            const auto& node = tree_index.node(no);
+            node.cumulative_edge_length = (parent == TreeIndex::NoNode ? 0.0 : tree_index.node(parent).cumulative_edge_length) + tree_index.edge_length(no);
+            if (tree_index.is_leaf(no) && node.cumulative_edge_length > mMaxCumulativeEdgeLength)
+                mMaxCumulativeEdgeLength = node.cumulative_edge_length;
         }
     }
-    else if (cumulative_edge_length > max_cumulative_edge_length) {
-        max_cumulative_edge_length = cumulative_edge_length;
-    }
 
-} // Node::compute_cumulative_edge_length
+} // Tree::compute_cumulative_edge_length
 
 // ----------------------------------------------------------------------
 
@@ -670,44 +914,25 @@ size_t Tree::longest_aa() const
 
 std::vector<const Node*> Tree::find_name(std::string aName) const
 {
-    std::vector<const Node*> path;
-    bool found = find_name_r(aName, path);
-    if (!found)
+    const auto& tree_index = index();
+    const auto leaf_no = tree_index.find_leaf_by_name(aName);
+    if (leaf_no == TreeIndex::NoNode)
         throw std::runtime_error(aName + " not found in the tree");
+    std::vector<const Node*> path;
+    for (auto no = leaf_no; no != TreeIndex::NoNode; no = tree_index.parent(no))
+        path.push_back(&tree_index.node(no));
+    std::reverse(path.begin(), path.end());
     return path;
 
 } // Tree::find_name
 
 // ----------------------------------------------------------------------
 
-bool Node::find_name_r(std::string aName, std::vector<const Node*>& aPath) const
-{
-    bool found = false;
-    if (is_leaf()) {
-        if (name == aName) {
-            aPath.push_back(this);
-            found = true;
-        }
-    }
-    else {
-        aPath.push_back(this);
-        for (const Node& child: subtree) {
-            found = child.find_name_r(aName, aPath);
-            if (found)
-                break;
-        }
-        if (!found)
-            aPath.pop_back();
-    }
-    return found;
-
-} // Node::find_name_r
-
-// ----------------------------------------------------------------------
-
 const Node* Tree::find_node_by_name(std::string aName) const
 {
-    return find_node(*this, [&](const Node& aNode) -> bool { return aNode.name == aName; });
+    const auto& tree_index = index();
+    const auto no = tree_index.find_node_by_name(aName);
+    return no == TreeIndex::NoNode ? nullptr : &tree_index.node(no);
 
 } // Tree::find_node_by_name
 
@@ -728,56 +953,49 @@ void Tree::re_root(const std::vector<const Node*>& aNewRoot)
     if (aNewRoot.front() != this)
         throw std::invalid_argument("Invalid path passed to Tree::re_root");
 
-    std::vector<Node> nodes;
-    for (size_t item_no = 0; item_no < (aNewRoot.size() - 1); ++item_no) {
-        const Node& source = *aNewRoot[item_no];
-        nodes.push_back(Node());
-        std::copy_if(source.subtree.begin(), source.subtree.end(), std::back_inserter(nodes.back().subtree), [&](const Node& to_copy) -> bool { return &to_copy != aNewRoot[item_no + 1]; });
-        nodes.back().edge_length = aNewRoot[item_no + 1]->edge_length;
-    }
-
-    std::vector<Node> new_subtree(aNewRoot.back()->subtree.begin(), aNewRoot.back()->subtree.end());
+      // nodes are moved (not copied) from the old subtrees, the path from the old root to the new one is reversed:
+      // new root gets children of aNewRoot.back() followed by new node having siblings of aNewRoot.back()
+      // and so on up to the old root, each new node gets edge length of the path node below it
+    const auto path_node = [&aNewRoot](size_t aItemNo) { return const_cast<Node*>(aNewRoot[aItemNo]); };
+    Subtree new_subtree = std::move(path_node(aNewRoot.size() - 1)->subtree);
     Subtree* append_to = &new_subtree;
-    for (auto child = nodes.rbegin(); child != nodes.rend(); ++child) {
-        append_to->push_back(*child);
-        append_to = &append_to->back().subtree;
+    std::vector<Node*> new_nodes; // the only nodes (besides the root) having new set of leaves, from the top down
+    for (size_t item_no = aNewRoot.size() - 1; item_no > 0; --item_no) {
+        Node& source = *path_node(item_no - 1);
+        append_to->emplace_back();
+        Node& node = append_to->back();
+        new_nodes.push_back(&node);
+        node.edge_length = aNewRoot[item_no]->edge_length;
+        node.subtree.reserve(source.subtree.size() - 1);
+        for (auto& child: source.subtree) {
+            if (&child != aNewRoot[item_no])
+                node.subtree.push_back(std::move(child));
+        }
+        append_to = &node.subtree;
     }
-    subtree = new_subtree;
+    subtree = std::move(new_subtree);
     edge_length = 0;
+    structure_changed();
 
-} // Tree::re_root
-
-// ----------------------------------------------------------------------
-
-std::pair<Node*,Node*> Tree::find_path_to_next_leaf(std::vector<std::pair<size_t, Node*>>& aPath)
-{
-    auto& back = aPath.back();
-    if (++back.first < back.second->subtree.size()) {
-        return std::make_pair(back.second->subtree[back.first].find_path_to_first_leaf(aPath), back.second);
-    }
-    else if (aPath.size() > 1) {
-        aPath.pop_back();
-        return find_path_to_next_leaf(aPath);
-    }
-    else {
-        return std::make_pair(nullptr, nullptr);         //  end of tree
+    new_nodes.insert(new_nodes.begin(), this);
+    for (auto node = new_nodes.rbegin(); node != new_nodes.rend(); ++node) { // the deepest first
+        (*node)->number_strains = 0;
+        for (const auto& child: (*node)->subtree)
+            (*node)->number_strains += child.number_strains;
     }
+    set_branch_id();            // all branch ids depend on the root
+    cumulative_edge_length_changed();
 
-} // Tree::find_path_to_next_leaf
+} // Tree::re_root
 
 // ----------------------------------------------------------------------
 
 const Node* Tree::find_next_leaf_node(const Node& aNode) const
 {
-    std::vector<const Node*> nodes = leaf_nodes_sorted_by([](const Node* a,const Node* b) -> bool { return a->line_no < b->line_no; });
-    const Node* result = nullptr;
-    for (size_t i = 0; i < (nodes.size() - 1); ++i) {
-        if (nodes[i] == &aNode) {
-            result = nodes[i + 1];
-            break;
-        }
-    }
-    return result;
+    const auto& tree_index = index();
+    const auto no = tree_index.node_no(aNode);
+    const auto next = no == TreeIndex::NoNode ? TreeIndex::NoNode : tree_index.next_shown_leaf(no);
+    return next == TreeIndex::NoNode ? nullptr : &tree_index.node(next);
 
 } // Tree::find_next_leaf_node
 
@@ -785,15 +1003,10 @@ const Node* Tree::find_next_leaf_node(const Node& aNode) const
 
 const Node* Tree::find_previous_leaf_node(const Node& aNode) const
 {
-    std::vector<const Node*> nodes = leaf_nodes_sorted_by([](const Node* a,const Node* b) -> bool { return a->line_no < b->line_no; });
-    const Node* result = nullptr;
-    for (size_t i = 1; i < nodes.size(); ++i) {
-        if (nodes[i] == &aNode) {
-            result = nodes[i - 1];
-            break;
-        }
-    }
-    return result;
+    const auto& tree_index = index();
+    const auto no = tree_index.node_no(aNode);
+    const auto previous = no == TreeIndex::NoNode ? TreeIndex::NoNode : tree_index.previous_shown_leaf(no);
+    return previous == TreeIndex::NoNode ? nullptr : &tree_index.node(previous);
 
 } // Tree::find_previous_leaf_node
 
@@ -804,27 +1017,32 @@ void Tree::make_hz_line_sections(double tolerance)
     compute_cumulative_edge_length();
       // std::cout << "max_cumulative_edge_length " << mMaxCumulativeEdgeLength << std::endl;
 
-      // compute edge_length_to_next
-    for (auto node_path = find_path_to_first_leaf(); node_path.first != nullptr; ) {
-        auto next_root = find_path_to_next_leaf(node_path.second);
-        if (next_root.first != nullptr) {
-            node_path.first->edge_length_to_next = node_path.first->cumulative_edge_length - next_root.second->cumulative_edge_length + next_root.first->cumulative_edge_length - next_root.second->cumulative_edge_length;
-              // std::cout << node_path.first->name << " " << node_path.first->edge_length_to_next << std::endl;
-        }
-        node_path.first = next_root.first;
+      // compute edge length from each leaf to the next one, i.e. through their common root
+    const auto& tree_index = index();
+    const auto& leaves = tree_index.leaves();
+    std::vector<double> edge_length_to_next(tree_index.size(), 0.0);
+    for (size_t leaf_no = 1; leaf_no < leaves.size(); ++leaf_no) {
+        const auto previous = leaves[leaf_no - 1], next = leaves[leaf_no];
+        auto common_root = tree_index.parent(next);
+        while (previous < common_root || previous >= tree_index.subtree_end(common_root))
+            common_root = tree_index.parent(common_root);
+        const auto common_root_cumulative_edge_length = tree_index.node(common_root).cumulative_edge_length;
+        edge_length_to_next[previous] = tree_index.node(previous).cumulative_edge_length - common_root_cumulative_edge_length + tree_index.node(next).cumulative_edge_length - common_root_cumulative_edge_length;
     }
 
-    const auto by_edge_length_to_next = leaf_nodes_sorted_by_edge_length_to_next(); // longest first!
-    for (const auto& node: by_edge_length_to_next) {
-        std::cout << node->name << " " << node->line_no << " " << node->edge_length_to_next << " " << (node->edge_length_to_next / mMaxCumulativeEdgeLength) << std::endl;
+    std::vector<TreeIndex::NodeNo> by_edge_length_to_next(leaves); // longest first!
+    std::sort(by_edge_length_to_next.begin(), by_edge_length_to_next.end(), [&](auto a, auto b) -> bool { return edge_length_to_next[b] < edge_length_to_next[a]; });
+    for (auto no: by_edge_length_to_next) {
+        const auto& node = tree_index.node(no);
+        std::cout << node.name << " " << node.line_no << " " << edge_length_to_next[no] << " " << (edge_length_to_next[no] / mMaxCumulativeEdgeLength) << std::endl;
     }
 
     init_hz_line_sections(true);
     auto& hz_line_sections = settings().draw_tree.hz_line_sections;
-    for (const auto& node: by_edge_length_to_next) {
-        if ((node->edge_length_to_next / mMaxCumulativeEdgeLength) < tolerance)
+    for (auto no: by_edge_length_to_next) {
+        if ((edge_length_to_next[no] / mMaxCumulativeEdgeLength) < tolerance)
             break;
-        hz_line_sections.emplace_back(*node, 0xFF0000);
+        hz_line_sections.emplace_back(tree_index.node(no), 0xFF0000);
     }
     hz_line_sections.sort();
 
@@ -834,13 +1052,9 @@ void Tree::make_hz_line_sections(double tolerance)
 
 void Tree::add_vaccine(std::string aId, std::string aLabel)
 {
-    const size_t id_len = aId.size();
-    auto find_nodes = [this,id_len,&aId,&aLabel](const Node& aNode) {
-        if (std::string(aNode.name, 0, id_len) == aId) {
-            settings().draw_tree.mark_nodes.add(aNode.name, aLabel);
-        }
-    };
-    iterate_leaf(*this, find_nodes);
+    const auto& tree_index = index();
+    for (auto leaf_no: tree_index.find_leaves_by_name_prefix(aId))
+        settings().draw_tree.mark_nodes.add(tree_index.node(leaf_no).name, aLabel);
 
 } // Tree::add_vaccine
 
@@ -2,10 +2,13 @@
 
 #include <string>
 #include <vector>
+#include <deque>
+#include <type_traits>
 
 #include "json-struct.hh"
 #include "date.hh"
 #include "settings.hh"
+#include "tree-index.hh"
 
 // ----------------------------------------------------------------------
 
@@ -100,8 +103,8 @@ class Node
     typedef std::vector<Node> Subtree;
     enum class LadderizeMethod { MaxEdgeLength, NumberOfLeaves };
 
-    inline Node() : edge_length(0), line_no(0), number_strains(1), vertical_gap_before(0), hidden(false) {}
-    inline Node(std::string aName, double aEdgeLength, const Date& aDate = Date()) : edge_length(aEdgeLength), name(aName), date(aDate), line_no(0), number_strains(1), vertical_gap_before(0), hidden(false) {}
+    inline Node() : edge_length(0), line_no(0), number_strains(1), hidden(false) {}
+    inline Node(std::string aName, double aEdgeLength, const Date& aDate = Date()) : edge_length(aEdgeLength), name(aName), date(aDate), line_no(0), number_strains(1), hidden(false) {}
     // inline Node(Node&&) = default;
     // inline Node(const Node&) = default;
     // inline Node& operator=(Node&&) = default; // needed for swap needed for sort
@@ -113,7 +116,6 @@ class Node
     Date date;
     size_t line_no;             // line at which the name is drawn
     std::string aa;             // aligned AA sequence for coloring by subst
-                                // for subtree: for each pos: space - children have different aa's at this pos (X not counted), letter - all children have the same aa at this pos (X not counted)
 
       // for coloring
     std::string continent;
@@ -121,12 +123,10 @@ class Node
 
       // subtree part
     Subtree subtree;
-    double top, bottom;         // subtree boundaries
     size_t number_strains;
     std::string branch_id;
 
     inline bool is_leaf() const { return subtree.empty() && !name.empty(); }
-    inline double middle() const { return is_leaf() ? static_cast<double>(line_no) : ((top + bottom) / 2.0); }
     int months_from(const Date& aStart) const; // returns negative if date of the node is earlier than aStart
 
     std::string display_name() const;
@@ -136,16 +136,6 @@ class Node
     AA_Transitions aa_transitions;
     mutable double cumulative_edge_length;
     void remove_aa_transition(size_t aPos, char aRight, bool aDescentUponRemoval); // recursively
-    void compute_cumulative_edge_length(double initial_edge_length, double& max_cumulative_edge_length) const;
-
-      // for ladderizing
-    double ladderize_max_edge_length;
-    Date ladderize_max_date;
-    std::string ladderize_max_name_alphabetically;
-
-      // for hz line sections
-    double edge_length_to_next;
-    mutable size_t vertical_gap_before; // if this node is the beginning of the hz line section, we may need to add gap when enumerating lines
 
       // for matching hi names for signature page
     std::vector<std::string> hi_names;
@@ -153,21 +143,7 @@ class Node
       // to hide leaves isolated before or having too big cumulative_edge_length
     bool hidden;
 
-    inline Node* find_path_to_first_leaf(std::vector<std::pair<size_t, Node*>>& path)
-        {
-            if (is_leaf()) {
-                return this;
-            }
-            else {
-                path.push_back(std::make_pair(0, this));
-                return subtree.front().find_path_to_first_leaf(path);
-            }
-        }
-
  protected:
-    void ladderize(LadderizeMethod aLadderizeMethod);
-    bool find_name_r(std::string aName, std::vector<const Node*>& aPath) const;
-
     friend inline auto json_fields(Node& a)
         {
             return std::make_tuple(
@@ -215,8 +191,9 @@ class Tree : public Node
     std::vector<const Node*> leaves() const;
 
       // aa transitions
-    void make_aa_transitions();
-    void make_aa_transitions(const std::vector<size_t>& aPositions);
+      // positions are processed in aThreads threads (0 - number of cores), result does not depend on the number of threads
+    void make_aa_transitions(size_t aThreads = 0);
+    void make_aa_transitions(const std::vector<size_t>& aPositions, size_t aThreads = 0);
 
     inline std::vector<const Node*> leaf_nodes_sorted_by_cumulative_edge_length() const
         {
@@ -240,29 +217,20 @@ class Tree : public Node
       // finds leaf node with the passed name and returns path to that node, the first pointer in the path is &Tree, the last pointer in the path is the found node.
     std::vector<const Node*> find_name(std::string aName) const;
     const Node* find_node_by_name(std::string aName) const;
+      // next/previous shown leaf in the order of lines (as numbered by prepare_for_drawing()), nullptr if there is none
     const Node* find_next_leaf_node(const Node& aNode) const;
     const Node* find_previous_leaf_node(const Node& aNode) const;
     void re_root(const std::vector<const Node*>& aNewRoot);
       // re-roots tree making the parent of the leaf node with the passed name root
     void re_root(std::string aName);
 
-    inline void compute_cumulative_edge_length() const
-        {
-            if (mMaxCumulativeEdgeLength < 0)
-                Node::compute_cumulative_edge_length(0, mMaxCumulativeEdgeLength);
-        }
+    void compute_cumulative_edge_length() const;
 
     void preprocess_upon_importing_from_external_format();
     void ladderize(LadderizeMethod aLadderizeMethod);
 
       // hz line sections
     void make_hz_line_sections(double tolerance);
-    inline std::vector<const Node*> leaf_nodes_sorted_by_edge_length_to_next() const // longest first!
-        {
-            compute_cumulative_edge_length();
-            return leaf_nodes_sorted_by([](const Node* a, const Node* b) -> bool { return b->edge_length_to_next < a->edge_length_to_next; });
-        }
-
 
     void add_vaccine(std::string aId, std::string aLabel);
 
@@ -271,30 +239,39 @@ class Tree : public Node
       // biggest cumulative_edge_length
     inline double width() const { compute_cumulative_edge_length(); return mMaxCumulativeEdgeLength; }
 
+      // flat representation of the tree, made upon the first use after construction or structure change
+    inline const TreeIndex& index() const
+        {
+            if (mIndex.empty())
+                mIndex.make(const_cast<Tree&>(*this));
+            return mIndex;
+        }
+
+      // must be called upon changing subtree vectors of the tree nodes (i.e. moving, adding, removing nodes)
+    inline void structure_changed() { mIndex.clear(); }
+
+      // Derived attributes of nodes are kept up to date by the methods editing the tree, each edit updates what it changes:
+      // number_strains - set by preprocess_upon_importing_from_external_format(), re_root() updates nodes on the new path only,
+      //                  ladderize() does not change it;
+      // branch_id - ladderize() renumbers subtrees of the reordered nodes only, re_root() renumbers all nodes;
+      // cumulative_edge_length - computed upon the next use (compute_cumulative_edge_length()) after re_root(), ladderize() does not change it;
+      // line_no - set by prepare_for_drawing().
+    inline void cumulative_edge_length_changed() { mMaxCumulativeEdgeLength = -1; }
+
  private:
     Settings mSettings;
     std::string mVirusType;     // set in match_seqdb
     std::string mLineage;       // set in match_seqdb
     mutable double mMaxCumulativeEdgeLength;
+    mutable TreeIndex mIndex;
 
     size_t longest_aa() const;
     void set_branch_id();
-    void set_line_no();
-    void set_top_bottom();
+    void set_branch_id(Node& aSubtreeRoot); // for the children of aSubtreeRoot and their descendants
+    void set_line_no(const HzLineSections& aSections);
     void init_hz_line_sections(bool reset = false);
     void hide_leaves(const SettingsDrawTree& aSettings);
 
-    inline std::pair<Node*, std::vector<std::pair<size_t, Node*>>> find_path_to_first_leaf()
-        {
-            std::vector<std::pair<size_t, Node*>> path;
-            Node* node = Node::find_path_to_first_leaf(path);
-            return std::make_pair(node, path);
-        }
-
-      // returns next leaf node and common root for the passed node and the next node.
-      // returns (nullptr, nullptr) if the last leaf node was passed
-    std::pair<Node*,Node*> find_path_to_next_leaf(std::vector<std::pair<size_t, Node*>>& aPath);
-
     std::vector<const Node*> leaf_nodes_sorted_by(const std::function<bool(const Node*,const Node*)>& cmp) const;
 
       // changes between "phylogenetic-tree-v1" and "phylogenetic-tree-v2"
@@ -316,107 +293,102 @@ class Tree : public Node
 
 // ----------------------------------------------------------------------
 
-template <typename N, typename F1> inline void iterate_leaf(N& aNode, F1 f_name)
+// Trees of big sets of sequences (RAxML, GARLI) are often thousands
+// levels deep, traversal uses explicit stack to avoid stack overflow.
+
+enum class Iterate { Continue, SkipSubtree, Stop };
+
+// Visits nodes in the pre-order: f_leaf(leaf) for leaf nodes, f_subtree_pre(subtree) and then f_subtree_post(subtree) after its children.
+// f_leaf and f_subtree_pre return Iterate: SkipSubtree - do not visit children (f_subtree_post is not called), Stop - stop iterating.
+// Returns true if stopped.
+template <typename N, typename F1, typename F2, typename F3> inline bool iterate_tree(N& aNode, F1 f_leaf, F2 f_subtree_pre, F3 f_subtree_post)
 {
-    if (aNode.is_leaf()) {
-        f_name(aNode);
+    typedef std::conditional_t<std::is_const<N>::value, const Node, Node> node_t;
+    if (aNode.is_leaf())
+        return f_leaf(aNode) == Iterate::Stop;
+    switch (f_subtree_pre(aNode)) {
+      case Iterate::Stop:
+          return true;
+      case Iterate::SkipSubtree:
+          return false;
+      case Iterate::Continue:
+          break;
     }
-    else {
-        for (auto& node: aNode.subtree) {
-            iterate_leaf(node, f_name);
+    typedef decltype(aNode.subtree.begin()) iterator_t;
+    struct Level { node_t* subtree; iterator_t next, end; };
+    std::deque<Level> path;     // ancestors of the subtree being visited, deque does not copy upon growing for deep trees
+    Level current{&aNode, aNode.subtree.begin(), aNode.subtree.end()};
+    for (;;) {
+        while (current.next != current.end) {
+            node_t& child = *current.next++;
+            if (child.is_leaf()) {
+                if (f_leaf(child) == Iterate::Stop)
+                    return true;
+            }
+            else {
+                switch (f_subtree_pre(child)) {
+                  case Iterate::Stop:
+                      return true;
+                  case Iterate::SkipSubtree:
+                      break;
+                  case Iterate::Continue:
+                      path.push_back(current);
+                      current = Level{&child, child.subtree.begin(), child.subtree.end()};
+                      break;
+                }
+            }
         }
+        f_subtree_post(*current.subtree);
+        if (path.empty())
+            break;
+        current = path.back();
+        path.pop_back();
     }
+    return false;
+}
+
+// ----------------------------------------------------------------------
+
+template <typename N, typename F1> inline void iterate_leaf(N& aNode, F1 f_name)
+{
+    iterate_tree(aNode, [&](auto& node) { f_name(node); return Iterate::Continue; }, [](auto&) { return Iterate::Continue; }, [](auto&) {});
 }
 
 // stops iterating if f_name returns true
 template <typename N, typename F1> inline bool iterate_leaf_stop(N& aNode, F1 f_name)
 {
-    bool stop = false;
-    if (aNode.is_leaf()) {
-        stop = f_name(aNode);
-    }
-    else {
-        for (auto& node: aNode.subtree) {
-            if ((stop = iterate_leaf_stop(node, f_name)))
-                break;
-        }
-    }
-    return stop;
+    return iterate_tree(aNode, [&](auto& node) { return f_name(node) ? Iterate::Stop : Iterate::Continue; }, [](auto&) { return Iterate::Continue; }, [](auto&) {});
 }
 
 template <typename N, typename F1, typename F3> inline void iterate_leaf_post(N& aNode, F1 f_name, F3 f_subtree_post)
 {
-    if (aNode.is_leaf()) {
-        f_name(aNode);
-    }
-    else {
-        for (auto& node: aNode.subtree) {
-            iterate_leaf_post(node, f_name, f_subtree_post);
-        }
-        f_subtree_post(aNode);
-    }
+    iterate_tree(aNode, [&](auto& node) { f_name(node); return Iterate::Continue; }, [](auto&) { return Iterate::Continue; }, f_subtree_post);
 }
 
 template <typename N, typename F1, typename F2> inline void iterate_leaf_pre(N& aNode, F1 f_name, F2 f_subtree_pre)
 {
-    if (aNode.is_leaf()) {
-        f_name(aNode);
-    }
-    else {
-        f_subtree_pre(aNode);
-        for (auto& node: aNode.subtree) {
-            iterate_leaf_pre(node, f_name, f_subtree_pre);
-        }
-    }
+    iterate_tree(aNode, [&](auto& node) { f_name(node); return Iterate::Continue; }, [&](auto& node) { f_subtree_pre(node); return Iterate::Continue; }, [](auto&) {});
 }
 
 // Stop descending the tree if f_subtree_pre returned false
 template <typename N, typename F1, typename F2> inline void iterate_leaf_pre_stop(N& aNode, F1 f_name, F2 f_subtree_pre)
 {
-    if (aNode.is_leaf()) {
-        f_name(aNode);
-    }
-    else {
-        if (f_subtree_pre(aNode)) {
-            for (auto& node: aNode.subtree) {
-                iterate_leaf_pre_stop(node, f_name, f_subtree_pre);
-            }
-        }
-    }
+    iterate_tree(aNode, [&](auto& node) { f_name(node); return Iterate::Continue; }, [&](auto& node) { return f_subtree_pre(node) ? Iterate::Continue : Iterate::SkipSubtree; }, [](auto&) {});
 }
 
 template <typename N, typename F3> inline void iterate_pre(N& aNode, F3 f_subtree_pre)
 {
-    if (!aNode.is_leaf()) {
-        f_subtree_pre(aNode);
-        for (auto& node: aNode.subtree) {
-            iterate_pre(node, f_subtree_pre);
-        }
-    }
+    iterate_tree(aNode, [](auto&) { return Iterate::Continue; }, [&](auto& node) { f_subtree_pre(node); return Iterate::Continue; }, [](auto&) {});
 }
 
 template <typename N, typename F3> inline void iterate_post(N& aNode, F3 f_subtree_post)
 {
-    if (!aNode.is_leaf()) {
-        for (auto& node: aNode.subtree) {
-            iterate_post(node, f_subtree_post);
-        }
-        f_subtree_post(aNode);
-    }
+    iterate_tree(aNode, [](auto&) { return Iterate::Continue; }, [](auto&) { return Iterate::Continue; }, f_subtree_post);
 }
 
 template <typename N, typename F1, typename F2, typename F3> inline void iterate_leaf_pre_post(N& aNode, F1 f_name, F2 f_subtree_pre, F3 f_subtree_post)
 {
-    if (aNode.is_leaf()) {
-        f_name(aNode);
-    }
-    else {
-        f_subtree_pre(aNode);
-        for (auto node = aNode.subtree.begin(); node != aNode.subtree.end(); ++node) {
-            iterate_leaf_pre_post(*node, f_name, f_subtree_pre, f_subtree_post);
-        }
-        f_subtree_post(aNode);
-    }
+    iterate_tree(aNode, [&](auto& node) { f_name(node); return Iterate::Continue; }, [&](auto& node) { f_subtree_pre(node); return Iterate::Continue; }, f_subtree_post);
 }
 
 // ----------------------------------------------------------------------
@@ -424,14 +396,13 @@ template <typename N, typename F1, typename F2, typename F3> inline void iterate
 template <typename P> inline const Node* find_node(const Node& aNode, P predicate)
 {
     const Node* r = nullptr;
-    if (predicate(aNode)) {
-        r = &aNode;
-    }
-    else if (! aNode.is_leaf()) {
-        for (auto node = aNode.subtree.begin(); r == nullptr && node != aNode.subtree.end(); ++node) {
-            r = find_node(*node, predicate);
-        }
-    }
+    auto check = [&](const Node& node) {
+        if (!predicate(node))
+            return Iterate::Continue;
+        r = &node;
+        return Iterate::Stop;
+    };
+    iterate_tree(aNode, check, check, [](const Node&) {});
     return r;
 }
 
@@ -439,17 +410,26 @@ template <typename P> inline const Node* find_node(const Node& aNode, P predicat
 
 inline const Node& find_first_leaf(const Node& aNode)
 {
-    return aNode.is_leaf() ? aNode : find_first_leaf(aNode.subtree.front());
+    const Node* node = &aNode;
+    while (!node->is_leaf())
+        node = &node->subtree.front();
+    return *node;
 }
 
 inline Node& find_first_leaf(Node& aNode)
 {
-    return aNode.is_leaf() ? aNode : find_first_leaf(aNode.subtree.front());
+    Node* node = &aNode;
+    while (!node->is_leaf())
+        node = &node->subtree.front();
+    return *node;
 }
 
 inline const Node& find_last_leaf(const Node& aNode)
 {
-    return aNode.is_leaf() ? aNode : find_last_leaf(aNode.subtree.back());
+    const Node* node = &aNode;
+    while (!node->is_leaf())
+        node = &node->subtree.back();
+    return *node;
 }
 
 // ----------------------------------------------------------------------
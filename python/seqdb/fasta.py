@@ -9,6 +9,7 @@ Functions for reading and generating fasta files.
 import os, re, collections, operator
 import logging; module_logger = logging.getLogger(__name__)
 from . import open_file, normalize
+import seqdb_backend
 
 # ======================================================================
 
@@ -17,7 +18,7 @@ class FastaReaderError (Exception):
 
 # ======================================================================
 
-def export_from_seqdb(seqdb, filename, output_format, amino_acids, lab, virus_type, lineage, gene, start_date, end_date, base_seq, name_format, aligned, truncate_left, encode_name, wrap, truncate_to_most_common_length, hamming_distance_threshold, hamming_distance_report, sort_by, with_hi_name, name_match):
+def export_from_seqdb(seqdb, filename, output_format, amino_acids, lab, virus_type, lineage, gene, start_date, end_date, base_seq, name_format, aligned, truncate_left, encode_name, wrap, truncate_to_most_common_length, hamming_distance_threshold, hamming_distance_report, sort_by, with_hi_name, name_match, cluster_max_mismatches=None):
 
     def make_entry(e):
         r = {
@@ -34,8 +35,7 @@ def export_from_seqdb(seqdb, filename, output_format, amino_acids, lab, virus_ty
     def left_part(e):
         return - (e["e"].seq.amino_acids_shift() if amino_acids else e["e"].seq.nucleotides_shift())
 
-    def exclude_by_hamming_distance(e1, e2, threshold):
-        hd = hamming_distance(e1["s"], e2["s"], e1["n"], e2["n"])
+    def exclude_by_hamming_distance(e1, e2, hd, threshold):
         if hd >= threshold:
             module_logger.info('{!r} excluded because hamming distance to {!r} is {} (threshold: {})'.format(e2["n"], e1["n"], hd, threshold))
             r = False
@@ -56,6 +56,15 @@ def export_from_seqdb(seqdb, filename, output_format, amino_acids, lab, virus_ty
             )
     if name_match is not None:
         iter = iter.filter_name_regex(name_match)
+
+    if not hamming_distance_threshold and not hamming_distance_report and cluster_max_mismatches is None:
+        # nothing to be done in python, names, sorting, padding and writing are in seqdb_backend
+        number_of_sequences, base_seq_name = iter.export_sequences(
+            filename=str(filename), output_format=output_format, amino_acids=amino_acids, aligned=aligned, truncate_left=truncate_left,
+            name_format=name_format, encode_name=encode_name, wrap=wrap, truncate_to_most_common_length=truncate_to_most_common_length,
+            sort_by=sort_by or "", base_seq=base_seq or "")
+        return {"base_seq": base_seq_name or None, "filename": filename, "hamming_distances": None, "number_of_sequences": number_of_sequences}
+
     sequences = [make_entry(e) for e in iter]
     left_part_size = 0 if truncate_left else max(left_part(seq) for seq in sequences)
     if left_part_size:
@@ -72,6 +81,9 @@ def export_from_seqdb(seqdb, filename, output_format, amino_acids, lab, virus_ty
     if not sequences:
         raise ValueError("No sequences found for exporting")
 
+    if cluster_max_mismatches is not None:
+        sequences = cluster_representatives(sequences, cluster_max_mismatches)
+
     # avoid repeated names
     sequences.sort(key=operator.itemgetter("n"))
     prev_name = None
@@ -115,12 +127,14 @@ def export_from_seqdb(seqdb, filename, output_format, amino_acids, lab, virus_ty
         truncate_to_most_common(sequences, fill="X" if amino_acids else "-")
 
     if hamming_distance_threshold:
-        sequences = list(filter(lambda s: exclude_by_hamming_distance(sequences[0], s, hamming_distance_threshold), sequences))
+        distances = seqdb_backend.hamming_distances(sequences[0]["s"], [e["s"] for e in sequences])
+        sequences = [e for e, hd in zip(sequences, distances) if exclude_by_hamming_distance(sequences[0], e, hd, hamming_distance_threshold)]
     if len(sequences) < 2:
         raise ValueError("Too few ({}) sequences found for exporting".format(len(sequences)))
 
     if hamming_distance_report:
-        hamming_distances = sorted(([e["n"], hamming_distance(sequences[0]["s"], e["s"], sequences[0]["n"], e["n"])] for e in sequences[1:]), key=operator.itemgetter(1), reverse=True)
+        distances = seqdb_backend.hamming_distances(sequences[0]["s"], [e["s"] for e in sequences[1:]])
+        hamming_distances = sorted(([e["n"], hd] for e, hd in zip(sequences[1:], distances)), key=operator.itemgetter(1), reverse=True)
     else:
         hamming_distances = None
 
@@ -132,6 +146,17 @@ def export_from_seqdb(seqdb, filename, output_format, amino_acids, lab, virus_ty
 
 # ----------------------------------------------------------------------
 
+def cluster_representatives(sequences, max_mismatches):
+    """Returns one sequence per cluster of sequences within max_mismatches, sequences with hi_names and then the newest ones are preferred as representatives."""
+    prioritized = sorted(sequences, key=operator.itemgetter("d"), reverse=True)
+    prioritized.sort(key=lambda e: not e["e"].seq.hi_names)
+    representatives = seqdb_backend.cluster_sequences([e["s"] for e in prioritized], max_mismatches)
+    r = [e for e_no, e in enumerate(prioritized) if representatives[e_no] == e_no]
+    module_logger.info('{} clusters of sequences within {} mismatches out of {} sequences'.format(len(r), max_mismatches, len(sequences)))
+    return r
+
+# ----------------------------------------------------------------------
+
 def most_common_length(sequences):
     len_stat = collections.Counter(len(e["s"]) for e in sequences)
     return len_stat.most_common(1)[0][0]
@@ -152,8 +177,7 @@ def truncate_to_most_common(sequences, fill):
 # ----------------------------------------------------------------------
 
 def hamming_distance(s1, s2, n1, n2):
-    l = min(len(s1), len(s2))
-    hd = sum(1 for pos in range(l) if s1[pos] != s2[pos])
+    hd = seqdb_backend.hamming_distance(s1, s2)
     # module_logger.debug('HD: {} {!r} {!r}'.format(hd, n1, n2))
     return hd
 
@@ -211,18 +235,12 @@ def read_fasta(fasta_file):
 # ----------------------------------------------------------------------
 
 def read_fasta_with_name_parsing(fasta_file, lab, virus_type, **_):
-    """Returns list of dict {"name":, "sequence":, "date":, "lab":}"""
-    np = name_parser()
-
-    def make_entry(raw_name, sequence):
-        n_entry = np.parse(raw_name, lab=lab)
-        if not n_entry:
-            raise RuntimeError("Cannot parse name: {!r}".format(raw_name))
-        entry = {"sequence": sequence, "lab": lab, "virus_type": virus_type}
-        entry.update(n_entry)
-        return entry
-
-    r = [make_entry(raw_name, sequence) for raw_name, sequence in read_from_string(open_file.open_for_reading_text(str(fasta_file)).read(), fasta_file)]
+    """Returns list of dict {"name":, "sequence":, "date":, "lab":}
+    Decompression, reading and name parsing (the same formats as in NameParser below) are done by seqdb_backend."""
+    try:
+        r = seqdb_backend.read_fasta_with_name_parsing(filename=str(fasta_file), lab=lab or "", virus_type=virus_type or "")
+    except RuntimeError as err:
+        raise FastaReaderError(str(err))
     module_logger.debug('{} sequences imported from {}'.format(len(r), fasta_file))
     return r
 
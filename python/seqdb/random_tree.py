@@ -0,0 +1,71 @@
+# -*- Python -*-
+# license
+# license.
+"""
+Random trees in the seqdb tree json format for benchmarks and tests.
+"""
+
+import random
+import logging; module_logger = logging.getLogger(__name__)
+from . import open_file
+
+# ======================================================================
+
+sAminoAcids = "ACDEFGHIKLMNPQRSTVWY"
+
+# ----------------------------------------------------------------------
+
+def random_tree(number_of_leaves, seed=1, aa_length=0, mean_edge_length=0.002, two_children_probability=0.9):
+    """Returns tree (dict to be dumped to json and read by import_tree)
+    with number_of_leaves leaves, the same tree for the same arguments.
+    Leaves get names, dates and (if aa_length > 0) aa sequences evolved
+    from the root sequence along the tree (about edge_length * aa_length
+    substitutions per edge). Some leaves get shorter sequences and X's to
+    look like real data. Number of strains and branch ids are set the same
+    way as for imported newick trees."""
+    rnd = random.Random(seed)
+    root = {"edge_length": 0.0, "id": "", "number_strains": number_of_leaves}
+    root_aa = [rnd.choice(sAminoAcids) for pos in range(aa_length)]
+    leaf_no = 0
+    to_visit = [(root, root_aa)]          # nodes are named and numbered in the pre-order
+    while to_visit:
+        node, aa = to_visit.pop()
+        if node["number_strains"] == 1:
+            leaf_no += 1
+            node["name"] = "RANDOM/{}/2016".format(leaf_no)
+            node["date"] = "2016-{:02d}-{:02d}".format(rnd.randint(1, 12), rnd.randint(1, 28))
+            if aa:
+                if rnd.random() < 0.02:
+                    for pos in rnd.sample(range(len(aa)), 3):
+                        aa[pos] = "X"
+                if rnd.random() < 0.05:
+                    del aa[rnd.randint(len(aa) * 4 // 5, len(aa) - 1):]
+                node["aa"] = "".join(aa)
+        else:
+            number_of_children = 2 if node["number_strains"] == 2 or rnd.random() < two_children_probability else 3
+            cuts = sorted(rnd.sample(range(1, node["number_strains"]), number_of_children - 1))
+            sizes = [end - start for start, end in zip([0] + cuts, cuts + [node["number_strains"]])]
+            prefix = node["id"] + ":" if node["id"] else ""
+            node["subtree"] = []
+            children = []
+            for child_no, size in enumerate(sizes, start=1):
+                child = {"edge_length": rnd.expovariate(1.0 / mean_edge_length), "id": prefix + str(child_no), "number_strains": size}
+                child_aa = list(aa)
+                if child_aa:
+                    for mutation in range(int(child["edge_length"] * aa_length + rnd.random())):
+                        child_aa[rnd.randrange(aa_length)] = rnd.choice(sAminoAcids)
+                node["subtree"].append(child)
+                children.append((child, child_aa))
+            to_visit.extend(reversed(children))
+    return {"  version": "phylogenetic-tree-v2", "tree": root}
+
+# ----------------------------------------------------------------------
+
+def write_random_tree(filename, number_of_leaves, **kwargs):
+    """Writes random_tree(number_of_leaves, **kwargs) to filename for import_tree."""
+    open_file.write_json(filename, random_tree(number_of_leaves, **kwargs), backup=False)
+
+# ======================================================================
+### Local Variables:
+### eval: (if (fboundp 'eu-rename-buffer) (eu-rename-buffer))
+### End:
@@ -32,16 +32,31 @@ class SeqdbUpdater:
     def set_hidb(self, hidb):
         self.hidb = hidb
 
-    def add(self, data):
-        """data is list of dicts {"date":, "lab":, "name":, "passage":, "sequence":, "virus_type":, "gene":}"""
+    def add(self, data, ingest=None):
+        """data is list of dicts {"date":, "lab":, "name":, "passage":, "sequence":, "virus_type":, "gene":}
+        ingest is seqdb_backend.SeqdbIngest which next() returned data, sequences it aligned in advance are used then."""
         self._normalize(data)
-        num_added = 0
         for entry in data:
-            self._add_sequence(entry)
+            if entry.get("annotatitions"):
+                module_logger.warning('Sequence {} has annotatitions {}'.format(entry.get("name"), entry["annotatitions"]))
+        # finding/creating entries and adding sequences is done in bulk by Seqdb.add_sequences
+        records = [self._make_record(entry) for entry in data]
+        if ingest is not None:
+            messages = ingest.add_sequences(seqdb=self.seqdb, records=records, check_names=self.normalize_names)
+        else:
+            messages = self.seqdb.add_sequences(records=records, check_names=self.normalize_names)
+        if messages:
+            module_logger.warning(messages)
         messages = self.seqdb.cleanup(remove_short_sequences=True)
         if messages:
             module_logger.warning(messages)
 
+    def align_with_references(self):
+        """aligns sequences that were not aligned by motifs using already aligned sequences as references"""
+        messages = self.seqdb.align_with_references()
+        if messages:
+            module_logger.info(messages)
+
     def add_clades(self):
         for entry_seq in self.seqdb.iter_seq():
             entry_seq.seq.update_clades(virus_type=entry_seq.entry.virus_type, lineage=entry_seq.entry.lineage)
@@ -57,40 +72,12 @@ class SeqdbUpdater:
 
     # ----------------------------------------------------------------------
 
-    sReName = re.compile(r"^(A\(H\d+N\d+\)|B)/")
-
-    def _add_sequence(self, data):
-        name = data.get("name")
-        if name:
-            if name[1] in ["/", "("] and data.get("virus_type") and name[0] != data["virus_type"][0]:
-                module_logger.warning('Virus type ({}) and name ({}) mismatch'.format(data["virus_type"], name))
-            entry = self.seqdb.find_by_name(name)
-            if entry is None:
-                if self.normalize_names and not self.sReName.match(name):
-                    module_logger.warning('Suspicious name {!r}'.format(name))
-                entry = self.seqdb.new_entry(name)
-                if data.get("virus_type"):
-                    entry.virus_type = data["virus_type"] # entry = {"N": name, "s": [], "v": data["virus_type"]}
-            self._update_db_entry(entry, data)
-        else:
-            module_logger.warning('Cannot add entry without name: {}'.format(data["lab_id"]))
-
-    def _update_db_entry(self, entry, data):
-        if data.get("virus_type") and entry.virus_type != data["virus_type"]:
-            raise RuntimeError("Cannot add {!r} to {!r}".format(data["virus_type"], entry.virus_type))
-        if data.get("location", {}).get("country"):
-            entry.country = data["location"]["country"]
-        if data.get("location", {}).get("continent"):
-            entry.continent = data["location"]["continent"]
-        if data.get("date"):
-            entry.add_date(data["date"])
-        if data.get("annotatitions"):
-            module_logger.warning('Sequence {} has annotatitions {}'.format(data["name"], data["annotatitions"]))
-        message = entry.add_or_update_sequence(sequence=data["sequence"], passage=data.get("passage", ""), reassortant=data.get("reassortant", ""), lab=data.get("lab", ""), lab_id=data.get("lab_id", ""), gene=data.get("gene", ""))
-        if message:
-            module_logger.warning("{}: {}".format(data["name"], message.replace("\n", " ")))
-        # if self.hidb:
-        #     self._match_hidb(entry, data)
+    def _make_record(self, data):
+        record = {k: v for k, v in data.items() if isinstance(v, str) and v}
+        for key in ["country", "continent"]:
+            if data.get("location", {}).get(key):
+                record[key] = data["location"][key]
+        return record
 
     # ----------------------------------------------------------------------
 
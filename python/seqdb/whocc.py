@@ -18,13 +18,21 @@ from .update import SeqdbUpdater
 # hidb_dir: ~/WHO
 # sequence_store_dir: ~/ac/tables-store/sequences
 
-def update(seqdb_path :Path, acmacs_url, hidb_dir :Path, sequence_store_dir :Path, input_files=None, load_existing_seqdb=False, save_seqdb=True):
+def update(seqdb_path :Path, acmacs_url, hidb_dir :Path, sequence_store_dir :Path, input_files=None, load_existing_seqdb=False, save_seqdb=True, align_statistics :Path=None, threads=0):
     acmacs.api(acmacs_url)
+    if align_statistics:
+        align_statistics_reset()
+        align_statistics_enable(True)
     db = Seqdb()
     hidb = HiDb(hidb_dir)
     files = collect_files(db, input_files, sequence_store_dir)
     db_updater = SeqdbUpdater(db, filename=seqdb_path, load=load_existing_seqdb, hidb=hidb)
-    read_file_one_by_one_update_db(db_updater, files)
+    read_file_one_by_one_update_db(db_updater, files, threads=threads)
+    db_updater.align_with_references()
+    if align_statistics:
+        align_statistics_enable(False)
+        Path(align_statistics).write_text(align_statistics_json())
+        module_logger.info('Alignment statistics written to {}'.format(align_statistics))
     db_updater.match_hidb()
     db_updater.add_clades()               # clades must be updated after matching with hidb, because matching provides info about B lineage
     module_logger.info(db.report())
@@ -57,13 +65,21 @@ def collect_files(db, input_files, source_dir :Path):
 
 # ----------------------------------------------------------------------
 
-def read_file_one_by_one_update_db(db_updater, files):
+def read_file_one_by_one_update_db(db_updater, files, threads=0):
+    # files without csv are read and aligned ahead by worker threads, seqdb is updated here in the order of files
+    ingest = SeqdbIngest(files=[[str(e["f"]), e["lab"], e["virus_type"] or ""] for e in files if not _csv_filename(e).exists()], threads=threads)
+    module_logger.info('{} threads reading fasta files'.format(ingest.number_of_threads()))
     for f_no, file_entry in enumerate(files, start=1):
         module_logger.info('{} {}'.format(f_no, file_entry["f"]))
-        data = read_file(file_entry)
+        if _csv_filename(file_entry).exists():
+            data = read_file(file_entry)
+            file_ingest = None
+        else:
+            data = ingest.next()
+            file_ingest = ingest
         module_logger.info('{} entries to update seqdb with'.format(len(data)))
         # pprint.pprint(data)
-        db_updater.add(data)
+        db_updater.add(data, ingest=file_ingest)
 
 # ----------------------------------------------------------------------
 
@@ -77,8 +93,11 @@ def make_file_entry(db, fn :Path):
 
 # ----------------------------------------------------------------------
 
+def _csv_filename(file_entry):
+    return Path(str(file_entry["f"]).replace(".fas", ".csv"))
+
 def read_file(file_entry):
-    csv_filename = Path(str(file_entry["f"]).replace(".fas", ".csv"))
+    csv_filename = _csv_filename(file_entry)
     if csv_filename.exists():
         data = fasta_old.read_fasta_with_csv(fasta_file=file_entry["f"], csv_file=csv_filename, **file_entry)
     else: